@@ -11,7 +11,7 @@ set linkerFlags=-incremental:no -opt:ref OpenGL32.lib Winmm.lib user32.lib Gdi32
 del game*.pdb > NUL 2> NUL
 echo WAITING FOR PDB > lock.tmp
 
-cl %compilerFlags% /LD ..\code\game.c /link %linkerFlags% /out:game.dll /EXPORT:game_update -PDB:game_%random%.pdb
+cl %compilerFlags% /LD ..\code\game.c /link %linkerFlags% /out:game.dll /EXPORT:game_update /EXPORT:game_simulate -PDB:game_%random%.pdb
 
 del lock.tmp
 
@@ -0,0 +1,25 @@
+#!/bin/sh
+
+mkdir -p build
+cd build
+
+# NOTE: the lvl5 headers are expected on the include path (CPATH), same as for build.bat
+compilerFlags="-O0 -g -std=gnu11 -fms-extensions -msse4.1 -fno-strict-aliasing -Wall -Wno-unused-variable -Wno-unused-function -Wno-unused-but-set-variable -Wno-missing-braces"
+
+linkerFlags="-lm -lpthread -ldl"
+
+
+echo WAITING FOR SO > lock.tmp
+
+cc $compilerFlags -shared -fPIC ../code/game.c -o game.so $linkerFlags
+
+rm -f lock.tmp
+
+cc $compilerFlags ../code/linux_main.c -o linux_main $linkerFlags -lX11 -lEGL -lasound
+
+# NOTE: no X11/EGL/ALSA, null gl and no sound. ./linux_headless --frames 10000
+# Record with ./linux_main --record run.rpl, then ./linux_headless --replay run.rpl
+# plays it back as fast as possible and prints frame and DEBUG section percentiles
+# ./linux_main --perm-image perm.img keeps perm in a file and boots from it while game.so is unchanged
+# ./linux_main --rewind keeps up to ten minutes of perm history in 256MB, F3 goes back a second
+cc $compilerFlags -DLINUX_HEADLESS=1 ../code/linux_main.c -o linux_headless $linkerFlags
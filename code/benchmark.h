@@ -0,0 +1,165 @@
+#ifndef BENCHMARK_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// NOTE(lvl5): timing distributions for replay benchmarks.
+// Frame times come from the platform clock. Section times come from the
+// debug events of the frame game_update just finished, so every
+// DEBUG_FUNCTION/DEBUG_SECTION shows up without extra markup
+
+#define BENCHMARK_MAX_SECTIONS 128
+#define BENCHMARK_MAX_DEPTH 64
+
+typedef struct {
+  char *name;
+  f64 *samples;
+  u64 frame_cycles; // NOTE(lvl5): summed over the current frame
+  b32 hit_this_frame;
+} Benchmark_Series;
+
+typedef struct {
+  u32 events[BENCHMARK_MAX_DEPTH];
+  i32 depth;
+} Benchmark_Stack;
+
+typedef struct {
+  Benchmark_Series frame; // NOTE(lvl5): seconds
+  Benchmark_Series sections[BENCHMARK_MAX_SECTIONS]; // NOTE(lvl5): cycles
+  i32 section_count;
+  i32 skipped_frame_count;
+
+  // NOTE(lvl5): debug events only have rdtsc, this gets cycles to seconds
+  u64 begin_cycles;
+  f64 begin_time;
+
+  // NOTE(lvl5): one stack per thread_index, workers interleave their events
+  Benchmark_Stack stacks[256];
+} Benchmark;
+
+
+void benchmark_begin(Benchmark *b, f64 time) {
+  zero_memory_slow(b, sizeof(Benchmark));
+  b->frame.name = "frame";
+  b->frame.samples = sb_new(f64, 1024);
+  b->begin_cycles = __rdtsc();
+  b->begin_time = time;
+}
+
+Benchmark_Series *benchmark_get_section(Benchmark *b, char *name) {
+  Benchmark_Series *result = 0;
+  for (i32 section_index = 0; section_index < b->section_count; section_index++) {
+    Benchmark_Series *s = b->sections + section_index;
+    // NOTE(lvl5): the names live in game.so and move on reload
+    if (strcmp(s->name, name) == 0) {
+      result = s;
+      break;
+    }
+  }
+
+  if (!result) {
+    assert(b->section_count < array_count(b->sections));
+    result = b->sections + b->section_count++;
+    result->name = strdup(name);
+    result->samples = sb_new(f64, 1024);
+  }
+  return result;
+}
+
+void benchmark_add_frame(Benchmark *b, f64 frame_seconds, Debug_State *debug) {
+  sb_push(b->frame.samples, frame_seconds);
+
+  // NOTE(lvl5): a paused debug state keeps overwriting the same frame
+  if (debug->pause) {
+    b->skipped_frame_count++;
+    return;
+  }
+
+  i32 frame_index = (debug->frame_index + array_count(debug->frames) - 1) %
+    array_count(debug->frames);
+  Debug_Frame *frame = debug->frames + frame_index;
+
+  for (i32 stack_index = 0; stack_index < array_count(b->stacks); stack_index++) {
+    b->stacks[stack_index].depth = 0;
+  }
+
+  for (u32 event_index = 0; event_index < frame->event_count; event_index++) {
+    Debug_Event *event = frame->events + event_index;
+    Benchmark_Stack *stack = b->stacks + event->thread_index;
+
+    if (event->type == Debug_Type_BEGIN_TIMER) {
+      assert(stack->depth < array_count(stack->events));
+      stack->events[stack->depth++] = event_index;
+    } else if (event->type == Debug_Type_END_TIMER && stack->depth > 0) {
+      Debug_Event *begin = frame->events + stack->events[--stack->depth];
+      assert(begin->id == event->id);
+
+      Benchmark_Series *s = benchmark_get_section(b, event->name);
+      s->frame_cycles += event->cycles - begin->cycles;
+      s->hit_this_frame = true;
+    }
+  }
+
+  for (i32 section_index = 0; section_index < b->section_count; section_index++) {
+    Benchmark_Series *s = b->sections + section_index;
+    if (s->hit_this_frame) {
+      sb_push(s->samples, (f64)s->frame_cycles);
+      s->frame_cycles = 0;
+      s->hit_this_frame = false;
+    }
+  }
+}
+
+int benchmark_compare_f64(const void *a_ptr, const void *b_ptr) {
+  f64 a = *(f64 *)a_ptr;
+  f64 b = *(f64 *)b_ptr;
+  int result = (a > b) - (a < b);
+  return result;
+}
+
+// NOTE(lvl5): nearest rank, samples must be sorted
+f64 benchmark_percentile(f64 *samples, u32 count, f64 percent) {
+  u32 rank = (u32)ceil(percent/100.0*count);
+  if (rank < 1) rank = 1;
+  f64 result = samples[rank - 1];
+  return result;
+}
+
+void benchmark_print_series(Benchmark_Series *s, f64 to_ms) {
+  u32 count = sb_count(s->samples);
+  if (count) {
+    qsort(s->samples, count, sizeof(f64), benchmark_compare_f64);
+    f64 total = 0;
+    for (u32 sample_index = 0; sample_index < count; sample_index++) {
+      total += s->samples[sample_index];
+    }
+
+    printf("%-32s %8u %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+           s->name, count,
+           total/count*to_ms,
+           benchmark_percentile(s->samples, count, 50)*to_ms,
+           benchmark_percentile(s->samples, count, 95)*to_ms,
+           benchmark_percentile(s->samples, count, 99)*to_ms,
+           s->samples[count - 1]*to_ms);
+  }
+}
+
+void benchmark_report(Benchmark *b, f64 time) {
+  f64 seconds = time - b->begin_time;
+  f64 cycles_per_second = (f64)(__rdtsc() - b->begin_cycles)/seconds;
+
+  printf("%-32s %8s %9s %9s %9s %9s %9s\n",
+         "ms", "count", "avg", "p50", "p95", "p99", "max");
+  benchmark_print_series(&b->frame, 1000.0);
+  for (i32 section_index = 0; section_index < b->section_count; section_index++) {
+    benchmark_print_series(b->sections + section_index, 1000.0/cycles_per_second);
+  }
+
+  if (b->skipped_frame_count) {
+    printf("%d frames had the debug view paused and have no section times\n",
+           b->skipped_frame_count);
+  }
+}
+
+#define BENCHMARK_H
+#endif
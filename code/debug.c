@@ -46,6 +46,7 @@ void debug_init(byte *debug_memory) {
   debug_state->vars[Debug_Var_Name_PERF] = (Debug_Var){const_string("perf"), 1};
   debug_state->vars[Debug_Var_Name_COLLIDERS] = (Debug_Var){const_string("colliders"), 1};
   debug_state->vars[Debug_Var_Name_MEMORY] = (Debug_Var){const_string("memory"), 0};
+  debug_state->vars[Debug_Var_Name_TICK_RATE] = (Debug_Var){const_string("tick_rate"), 60};
   
   
   // NOTE(lvl5): terminal
@@ -72,6 +73,23 @@ void debug_add_arena(Arena *arena, String name) {
 #define LINE_INTERVAL 20
 #define DEBUG_BG_COLOR V4(0, 0, 0, 0.7f)
 
+// NOTE(lvl5): inside a layer the atlases draw in the order they first show
+// up, so the backgrounds and the text can't share one. Each part of the gui
+// gets a layer for its rects and the one above it for its text.
+// Everything else overlaps the terminal and goes over it
+#define DEBUG_LAYER_TERMINAL 0
+#define DEBUG_LAYER_GUI 2
+
+void debug_push_rect(Render_Group *group, i32 layer, rect2 rect) {
+  render_layer(group, layer);
+  push_rect(group, rect);
+}
+
+void debug_push_text(Render_Group *group, i32 layer, String str) {
+  render_layer(group, layer + 1);
+  push_text(group, str);
+}
+
 
 void debug_terminal_history_save(Debug_Terminal *term) {
   String entry = alloc_string(&term->arena, term->input_data + 1, term->input_count - 2);
@@ -223,7 +241,7 @@ void debug_draw_terminal(Debug_Terminal *term, Render_Group *group, Input *input
     }
   }
   
-  push_rect(group, terminal_rect);
+  debug_push_rect(group, DEBUG_LAYER_TERMINAL, terminal_rect);
   
   
   render_translate(group, V3(0, -terminal_height + 5, 0));
@@ -233,11 +251,12 @@ void debug_draw_terminal(Debug_Terminal *term, Render_Group *group, Input *input
   } else {
     render_color(group, V4(0, 0, 0, 0));
   }
-  push_rect(group, rect2_min_size(V2(term->cursor*letter_size, -3),
-                                  V2(letter_size, 15)));
+  debug_push_rect(group, DEBUG_LAYER_TERMINAL,
+                  rect2_min_size(V2(term->cursor*letter_size, -3),
+                                 V2(letter_size, 15)));
   
   render_color(group, COLOR_WHITE);
-  push_text(group, terminal_string);
+  debug_push_text(group, DEBUG_LAYER_TERMINAL, terminal_string);
   
   
   u32 line_count = sb_count(term->lines);
@@ -246,7 +265,7 @@ void debug_draw_terminal(Debug_Terminal *term, Render_Group *group, Input *input
        shown_line_index++) {
     u32 line_index = line_count - shown_line_index - 1;
     render_translate(group, V3(0, LINE_INTERVAL, 0));
-    push_text(group, term->lines[line_index]);
+    debug_push_text(group, DEBUG_LAYER_TERMINAL, term->lines[line_index]);
   }
   
   render_restore(group);
@@ -292,7 +311,7 @@ void debug_draw_gui(State *state, v2 screen_size, Input *input, f32 dt) {
       String *str = (String *)scratch_alloc(sizeof(String));
       *str = alloc_string(&get_context()->scratch, 
                           buffer, c_string_length(buffer));
-      push_text(group, *str);
+      debug_push_text(group, DEBUG_LAYER_GUI, *str);
       render_translate(group, V3(0, -LINE_INTERVAL, 0));
     }
     
@@ -308,7 +327,7 @@ void debug_draw_gui(State *state, v2 screen_size, Input *input, f32 dt) {
                                screen_size.y*0.5f - total_heigt,
                                0));
     render_color(group, DEBUG_BG_COLOR);
-    push_rect(group, rect2_min_size(V2(0, 0), V2(total_width, total_heigt)));
+    debug_push_rect(group, DEBUG_LAYER_GUI, rect2_min_size(V2(0, 0), V2(total_width, total_heigt)));
     
 #define MAX_CYCLES 40891803
     {
@@ -325,7 +344,7 @@ void debug_draw_gui(State *state, v2 screen_size, Input *input, f32 dt) {
                 (f32)(end_cycles - begin_cycles)/(f32)MAX_CYCLES*16.6f);
       
       String str = from_c_string(buffer);
-      push_text(group, str);
+      debug_push_text(group, DEBUG_LAYER_GUI, str);
       render_restore(group);
     }
     
@@ -415,7 +434,7 @@ void debug_draw_gui(State *state, v2 screen_size, Input *input, f32 dt) {
         }
         
         render_color(group, color);
-        push_rect(group, rect);
+        debug_push_rect(group, DEBUG_LAYER_GUI, rect);
         render_translate(group, V3(rect_width, 0, 0));
       }
     }
@@ -456,7 +475,7 @@ void debug_draw_gui(State *state, v2 screen_size, Input *input, f32 dt) {
                                         group->state.matrix);
         
         render_color(group, DEBUG_BG_COLOR);
-        push_rect(group, on_screen_rect);
+        debug_push_rect(group, DEBUG_LAYER_GUI, on_screen_rect);
         
         i32 child_indices_count = node->one_past_last_child_index - 
           node->first_child_index;
@@ -477,7 +496,7 @@ void debug_draw_gui(State *state, v2 screen_size, Input *input, f32 dt) {
         }
         
         render_translate(group, V3(0, 5, 0));
-        push_text(group, str);
+        debug_push_text(group, DEBUG_LAYER_GUI, str);
         render_restore(group);
         
         render_translate(group, V3(0, -LINE_INTERVAL, 0));
@@ -561,7 +580,7 @@ void debug_draw_gui(State *state, v2 screen_size, Input *input, f32 dt) {
               rect2_min_size(V2(0, 0), V2(rect_width, LINE_INTERVAL));
             
             render_color(group, DEBUG_BG_COLOR);
-            push_rect(group, on_screen_rect);
+            debug_push_rect(group, DEBUG_LAYER_GUI, on_screen_rect);
             
             i32 child_indices_count = node->one_past_last_child_index -
               node->first_child_index;
@@ -569,7 +588,7 @@ void debug_draw_gui(State *state, v2 screen_size, Input *input, f32 dt) {
             render_color(group, COLOR_WHITE);
             
             render_translate(group, V3(0, 5, 0));
-            push_text(group, str);
+            debug_push_text(group, DEBUG_LAYER_GUI, str);
             render_restore(group);
             
             render_translate(group, V3(0, -LINE_INTERVAL, 0));
@@ -598,7 +617,7 @@ void debug_draw_gui(State *state, v2 screen_size, Input *input, f32 dt) {
     }
   }
   
-  render_group_output(&debug_state->arena, group, &state->renderer);
+  render_group_output(&debug_state->arena, group, state->renderer);
   arena_set_mark(&debug_state->arena, debug_render_memory);
   
   DEBUG_FUNCTION_END();
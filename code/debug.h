@@ -87,6 +87,7 @@ typedef enum {
   Debug_Var_Name_PERF,
   Debug_Var_Name_COLLIDERS,
   Debug_Var_Name_MEMORY,
+  Debug_Var_Name_TICK_RATE,
   
   Debug_Var_Name_count,
 } Debug_Var_Name;
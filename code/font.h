@@ -13,6 +13,7 @@ typedef struct {
   Bitmap bmp;
   rect2i *rects;
   i32 sprite_count;
+  u32 generation; // NOTE(lvl5): bump after changing bmp so it gets uploaded again
 } Texture_Atlas;
 
 
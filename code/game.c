@@ -6,6 +6,7 @@
 #include <lvl5_opengl.h>
 #include <lvl5_stretchy_buffer.h>
 #include <lvl5_random.h>
+#include <math.h>
 
 #define STB_TRUETYPE_IMPLEMENTATION
 #include <stb_truetype.h>
@@ -105,7 +106,7 @@ audio_state.sound_count to 64
  
  -[ ] tilemap collision
  -[ ] collision rules?
- -[ ] grid / quadtree
+ -[x] grid / quadtree
  
  [ ] basic procedural generation
  [ ] 5 enemy types
@@ -121,10 +122,192 @@ audio_state.sound_count to 64
 
 globalvar Render_Group *global_group = 0;
 
+void entity_slot_map_init(Entity_Slot_Map *map) {
+  map->slot_count = 1;
+  map->free_count = 0;
+  map->live_count = 0;
+  map->dead_count = 0;
+}
+
+void entity_tables_init(State *state) {
+  // NOTE(lvl5): 0th element of every table is the null component,
+  // so entities without a component read zeroes from it
+  state->motion.count = 1;
+  state->ai.count = 1;
+  state->skills.count = 1;
+  state->lifetimes.count = 1;
+  state->resources.count = 1;
+}
+
+i32 entity_add_motion(State *state, Entity *e) {
+  Motion_Table *table = &state->motion;
+  assert(table->count < MAX_ENTITY_COUNT);
+  i32 index = table->count++;
+  table->entity_index[index] = e->index;
+  table->p[index] = v3_zero();
+  table->prev_p[index] = v3_zero();
+  table->d_p[index] = v3_zero();
+  table->move_dir[index] = v2_zero();
+  table->speed[index] = 0;
+  table->friction[index] = 0;
+  e->motion_index = index;
+  return index;
+}
+
+i32 entity_add_ai(State *state, Entity *e) {
+  Ai_Table *table = &state->ai;
+  assert(table->count < MAX_ENTITY_COUNT);
+  i32 index = table->count++;
+  table->entity_index[index] = e->index;
+  table->state[index] = Ai_State_IDLE;
+  table->progress[index] = 0;
+  table->aggro_handle[index] = NULL_ENTITY_HANDLE;
+  table->target_move_p[index] = v3_zero();
+  e->ai_index = index;
+  return index;
+}
+
+i32 entity_add_skills(State *state, Entity *e) {
+  Skill_Table *table = &state->skills;
+  assert(table->count < MAX_ENTITY_COUNT);
+  i32 index = table->count++;
+  table->entity_index[index] = e->index;
+  for (i32 skill_index = 0; skill_index < SKILL_SLOT_COUNT; skill_index++) {
+    Skill zero_skill = {0};
+    table->skills[index][skill_index] = zero_skill;
+    table->cooldowns[index][skill_index] = 0;
+  }
+  table->target_p[index] = v3_zero();
+  e->skills_index = index;
+  return index;
+}
+
+i32 entity_add_lifetime(State *state, Entity *e, f32 time) {
+  Lifetime_Table *table = &state->lifetimes;
+  assert(table->count < MAX_ENTITY_COUNT);
+  i32 index = table->count++;
+  table->entity_index[index] = e->index;
+  table->time[index] = time;
+  e->lifetime_index = index;
+  return index;
+}
+
+i32 entity_add_resources(State *state, Entity *e, f32 hp, f32 mp) {
+  Resource_Table *table = &state->resources;
+  assert(table->count < MAX_ENTITY_COUNT);
+  i32 index = table->count++;
+  table->entity_index[index] = e->index;
+  table->hp[index] = hp;
+  table->hp_max[index] = hp;
+  table->hp_regen[index] = 0;
+  table->mp[index] = mp;
+  table->mp_max[index] = mp;
+  table->mp_regen[index] = 0;
+  e->resources_index = index;
+  return index;
+}
+
+// NOTE(lvl5): swap-removes keep the tables dense, the moved component
+// has to tell its owner where it went
+void motion_table_remove(State *state, i32 index) {
+  Motion_Table *table = &state->motion;
+  i32 last = --table->count;
+  if (index != last) {
+    table->entity_index[index] = table->entity_index[last];
+    table->p[index] = table->p[last];
+    table->prev_p[index] = table->prev_p[last];
+    table->d_p[index] = table->d_p[last];
+    table->move_dir[index] = table->move_dir[last];
+    table->speed[index] = table->speed[last];
+    table->friction[index] = table->friction[last];
+    state->entities.slots[table->entity_index[index]].motion_index = index;
+  }
+}
+
+void ai_table_remove(State *state, i32 index) {
+  Ai_Table *table = &state->ai;
+  i32 last = --table->count;
+  if (index != last) {
+    table->entity_index[index] = table->entity_index[last];
+    table->state[index] = table->state[last];
+    table->progress[index] = table->progress[last];
+    table->aggro_handle[index] = table->aggro_handle[last];
+    table->target_move_p[index] = table->target_move_p[last];
+    state->entities.slots[table->entity_index[index]].ai_index = index;
+  }
+}
+
+void skill_table_remove(State *state, i32 index) {
+  Skill_Table *table = &state->skills;
+  i32 last = --table->count;
+  if (index != last) {
+    table->entity_index[index] = table->entity_index[last];
+    for (i32 skill_index = 0; skill_index < SKILL_SLOT_COUNT; skill_index++) {
+      table->skills[index][skill_index] = table->skills[last][skill_index];
+      table->cooldowns[index][skill_index] = table->cooldowns[last][skill_index];
+    }
+    table->target_p[index] = table->target_p[last];
+    state->entities.slots[table->entity_index[index]].skills_index = index;
+  }
+}
+
+void lifetime_table_remove(State *state, i32 index) {
+  Lifetime_Table *table = &state->lifetimes;
+  i32 last = --table->count;
+  if (index != last) {
+    table->entity_index[index] = table->entity_index[last];
+    table->time[index] = table->time[last];
+    state->entities.slots[table->entity_index[index]].lifetime_index = index;
+  }
+}
+
+void resource_table_remove(State *state, i32 index) {
+  Resource_Table *table = &state->resources;
+  i32 last = --table->count;
+  if (index != last) {
+    table->entity_index[index] = table->entity_index[last];
+    table->hp[index] = table->hp[last];
+    table->hp_max[index] = table->hp_max[last];
+    table->hp_regen[index] = table->hp_regen[last];
+    table->mp[index] = table->mp[last];
+    table->mp_max[index] = table->mp_max[last];
+    table->mp_regen[index] = table->mp_regen[last];
+    state->entities.slots[table->entity_index[index]].resources_index = index;
+  }
+}
+
+v3 entity_get_p(State *state, Entity *e) {
+  v3 result = state->motion.p[e->motion_index];
+  return result;
+}
+
+// NOTE(lvl5): places the entity without interpolating from the old position
+void entity_set_p(State *state, Entity *e, v3 p) {
+  assert(e->motion_index);
+  state->motion.p[e->motion_index] = p;
+  state->motion.prev_p[e->motion_index] = p;
+}
+
+v3 entity_get_render_p(State *state, Entity *e, f32 alpha) {
+  v3 prev_p = state->motion.prev_p[e->motion_index];
+  v3 p = state->motion.p[e->motion_index];
+  v3 result = lerp_v3(prev_p, p, V3(alpha, alpha, alpha));
+  return result;
+}
+
+Transform entity_get_transform(State *state, Entity *e) {
+  Transform result;
+  result.p = entity_get_p(state, e);
+  result.scale = e->scale;
+  result.angle = e->angle;
+  return result;
+}
+
 Entity *get_entity(State *state, i32 index) {
-  assert(index < state->entity_count);
+  Entity_Slot_Map *map = &state->entities;
+  assert(index < map->slot_count);
   assert(index != 0);
-  Entity *result = state->entities + index;
+  Entity *result = map->slots + index;
   if (!result->is_active) {
     result = null;
   }
@@ -132,24 +315,37 @@ Entity *get_entity(State *state, i32 index) {
 }
 
 Entity *add_entity(State *state) {
-  assert(state->entity_count < array_count(state->entities));
+  Entity_Slot_Map *map = &state->entities;
   
   i32 index;
-  if (state->entities_free_count) {
-    index = state->entities_free_list[--state->entities_free_count];
+  if (map->free_count) {
+    index = map->free_list[--map->free_count];
   } else {
-    index = state->entity_count++;
+    assert(map->slot_count < array_count(map->slots));
+    index = map->slot_count++;
+  }
+  
+  u32 generation = (map->generations[index] + 1) & ENTITY_GENERATION_MASK;
+  if (!generation) {
+    generation = 1;
   }
+  map->generations[index] = generation;
   
-  Entity *e = state->entities + index;
+  map->live_positions[index] = map->live_count;
+  map->live[map->live_count++] = index;
+  
+  Entity *e = map->slots + index;
   Entity zero_entity = {0};
   *e = zero_entity;
   
   e->is_active = true;
-  e->t = transform_default();
-  e->id = state->unique_entity_id++;
+  e->scale = V3(1, 1, 1);
+  e->id = (i32)(generation << ENTITY_INDEX_BITS) | index;
   e->index = index;
   
+  // NOTE(lvl5): everything in the world has a position
+  entity_add_motion(state, e);
+  
   return e;
 }
 
@@ -177,12 +373,16 @@ Entity_Handle get_entity_handle(Entity *e) {
   return result;
 }
 
-void flag_set(u64 *flags, u64 flag) {
-  *flags |= flag;
-}
-
-void flag_remove(u64 *flags, u64 flag) {
-  *flags &= ~flag;
+u32 bit_scan_forward_u64(u64 value) {
+  assert(value);
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward64(&index, value);
+  u32 result = (u32)index;
+#else
+  u32 result = (u32)__builtin_ctzll(value);
+#endif
+  return result;
 }
 
 b32 flag_is_set(u64 flags, u64 flag) {
@@ -190,27 +390,78 @@ b32 flag_is_set(u64 flags, u64 flag) {
   return result;
 }
 
+Entity_Flag_List *get_flag_list(State *state, Entity_Flag flag) {
+  u32 flag_index = bit_scan_forward_u64(flag);
+  assert(flag_index < ENTITY_FLAG_COUNT);
+  Entity_Flag_List *result = state->flag_lists + flag_index;
+  return result;
+}
+
+void flag_list_remove(State *state, Entity *e, u32 flag_index) {
+  Entity_Flag_List *list = state->flag_lists + flag_index;
+  i32 position = e->flag_positions[flag_index];
+  i32 last = list->entities[--list->count];
+  list->entities[position] = last;
+  state->entities.slots[last].flag_positions[flag_index] = position;
+}
+
+void flag_set(State *state, Entity *e, Entity_Flag flag) {
+  if (flag_is_set(e->flags, flag)) return;
+  e->flags |= flag;
+  
+  u32 flag_index = bit_scan_forward_u64(flag);
+  Entity_Flag_List *list = get_flag_list(state, flag);
+  e->flag_positions[flag_index] = list->count;
+  list->entities[list->count++] = e->index;
+}
+
+// NOTE(lvl5): a dead entity keeps its flags but is already out of the
+// lists, removing it again would swap in whatever is at its old position
+void flag_remove(State *state, Entity *e, Entity_Flag flag) {
+  if (!e->is_active || !flag_is_set(e->flags, flag)) return;
+  e->flags &= ~flag;
+  flag_list_remove(state, e, bit_scan_forward_u64(flag));
+}
+
+// NOTE(lvl5): usage:
+// for (Entity_Iterator it = iterate_entities_flag(state, flag); 
+//      entity_iterator_next(state, &it);) { it.e ... }
+// don't remove entities with that flag while iterating
+Entity_Iterator iterate_entities_flag(State *state, Entity_Flag flag) {
+  Entity_Iterator result = {0};
+  result.list = get_flag_list(state, flag);
+  result.position = -1;
+  return result;
+}
+
+b32 entity_iterator_next(State *state, Entity_Iterator *it) {
+  it->position++;
+  b32 result = it->position < it->list->count;
+  if (result) {
+    it->e = state->entities.slots + it->list->entities[it->position];
+  } else {
+    it->e = null;
+  }
+  return result;
+}
+
 Entity *add_entity_player(State *state) {
   Entity *e = add_entity(state);
   
-  e->hp.v = 10;
-  e->hp.max = 10;
-  e->hp.regen = 0;
-  
-  e->mp.v = 10;
-  e->mp.max = 10;
-  e->mp.regen = 1.0f;
+  i32 resources = entity_add_resources(state, e, 10, 10);
+  state->resources.mp_regen[resources] = 1.0f;
   
   e->collider.box.rect = rect2_center_size(V2(0, 0), V2(1, 1));
   e->collider.type = Collider_Type_BOX;
   e->controller_type = Controller_Type_PLAYER;
-  e->friction = 0.92f;
-  e->speed = 1.0f;
+  state->motion.friction[e->motion_index] = 0.92f;
+  state->motion.speed[e->motion_index] = 1.0f;
   e->team = Entity_Team_PLAYER;
-  flag_set(&e->flags, Entity_Flag_PLAYER);
-  flag_set(&e->flags, Entity_Flag_ACTOR);
+  flag_set(state, e, Entity_Flag_PLAYER);
+  flag_set(state, e, Entity_Flag_ACTOR);
   
-  e->skills[0] = (Skill){
+  Skill *skills = state->skills.skills[entity_add_skills(state, e)];
+  skills[0] = (Skill){
     .type = Skill_Type_FIREBALL,
     .damage = 1,
     .mp_cost = 2.0f,
@@ -218,7 +469,7 @@ Entity *add_entity_player(State *state) {
   };
   
   
-  e->skills[1] = (Skill){
+  skills[1] = (Skill){
     .type = Skill_Type_BLINK,
     .mp_cost = 4.0f,
   };
@@ -229,29 +480,24 @@ Entity *add_entity_player(State *state) {
 Entity *add_entity_shooter(State *state) {
   Entity *e = add_entity(state);
   
-  e->hp.v = 2;
-  e->hp.max = 2;
-  e->hp.regen = 0;
+  entity_add_resources(state, e, 2, 0);
   
-  e->mp.v = 0;
-  e->mp.max = 0;
-  e->mp.regen = 0;
-  
-  e->speed = 0;//0.5f;
+  state->motion.speed[e->motion_index] = 0;//0.5f;
   e->collider.box.rect = rect2_center_size(V2(0, 0), V2(1, 1));
   e->collider.type = Collider_Type_BOX;
   e->controller_type = Controller_Type_AI_SHOOTER;
-  e->friction = 0.92f;
-  e->ai_state = Ai_State_IDLE;
+  state->motion.friction[e->motion_index] = 0.92f;
+  entity_add_ai(state, e);
   e->team = Entity_Team_ENEMY;
-  flag_set(&e->flags, Entity_Flag_ACTOR);
+  flag_set(state, e, Entity_Flag_ACTOR);
   
   
-  e->skills[0] = (Skill){
+  Skill *skills = state->skills.skills[entity_add_skills(state, e)];
+  skills[0] = (Skill){
     .type = Skill_Type_FIREBALL,
     .damage = 1,
     .mp_cost = 0,
-    .cooldown.max = 1.0f,
+    .cooldown = 1.0f,
     .accuracy = 0.95f,
   };
   
@@ -273,10 +519,9 @@ Entity *add_entity_fireball(State *state) {
   
   e->collider.box.rect = rect2_center_size(V2(0, 0), V2(1, 1));
   e->collider.type = Collider_Type_BOX;
-  e->lifetime.active = true;
-  e->lifetime.time = 3.0f;
-  e->friction = 1;
-  flag_set(&e->flags, Entity_Flag_PROJECTILE);
+  entity_add_lifetime(state, e, 3.0f);
+  state->motion.friction[e->motion_index] = 1;
+  flag_set(state, e, Entity_Flag_PROJECTILE);
   
   return e;
 }
@@ -284,11 +529,84 @@ Entity *add_entity_fireball(State *state) {
 
 
 void remove_entity(State *state, Entity *removed) {
-  if (removed->misc_storage_index) {
-    state->misc_entity_storage_free_list[state->misc_entity_storage_free_count++] = removed->misc_storage_index;
-  }
+  // NOTE(lvl5): an entity can die twice in one frame, 
+  // e.g. a fireball hit and its lifetime running out
+  if (!removed->is_active) return;
+  
+  Entity_Slot_Map *map = &state->entities;
   removed->is_active = false;
-  state->entities_free_list[state->entities_free_count++] = removed->index;
+  map->dead[map->dead_count++] = removed->index;
+  
+  // NOTE(lvl5): leave the flags set, only the lists forget the entity
+  u64 flags = removed->flags;
+  while (flags) {
+    u32 flag_index = bit_scan_forward_u64(flags);
+    flags &= flags - 1;
+    flag_list_remove(state, removed, flag_index);
+  }
+}
+
+void entity_slot_map_collect_dead(State *state) {
+  Entity_Slot_Map *map = &state->entities;
+  
+  for (i32 dead_index = 0; dead_index < map->dead_count; dead_index++) {
+    i32 index = map->dead[dead_index];
+    Entity *removed = map->slots + index;
+    
+    if (removed->misc_storage_index) {
+      state->misc_entity_storage_free_list[state->misc_entity_storage_free_count++] = removed->misc_storage_index;
+    }
+    
+    if (removed->motion_index) motion_table_remove(state, removed->motion_index);
+    if (removed->ai_index) ai_table_remove(state, removed->ai_index);
+    if (removed->skills_index) skill_table_remove(state, removed->skills_index);
+    if (removed->lifetime_index) lifetime_table_remove(state, removed->lifetime_index);
+    if (removed->resources_index) resource_table_remove(state, removed->resources_index);
+    
+    i32 live_position = map->live_positions[index];
+    i32 last = map->live[--map->live_count];
+    map->live[live_position] = last;
+    map->live_positions[last] = live_position;
+    
+    map->free_list[map->free_count++] = index;
+  }
+  map->dead_count = 0;
+}
+
+Entity_Command *push_entity_command(Entity_Command_Segment *segment, 
+                                    Entity_Command_Type type, Entity *e) {
+  Entity_Command_Segment *block = segment->tail ? segment->tail : segment;
+  if (block->count == array_count(block->commands)) {
+    // NOTE(lvl5): only the main thread's segment can fill up
+    assert(segment->overflow_arena);
+    Entity_Command_Segment *next = arena_push_array(segment->overflow_arena,
+                                                    Entity_Command_Segment, 1);
+    next->count = 0;
+    next->overflow_arena = 0;
+    next->next = 0;
+    next->tail = 0;
+    block->next = next;
+    segment->tail = next;
+    block = next;
+  }
+  Entity_Command *result = block->commands + block->count++;
+  result->type = type;
+  result->entity_id = e->id;
+  return result;
+}
+
+void push_command_despawn(Entity_Command_Segment *segment, Entity *e) {
+  push_entity_command(segment, Entity_Command_Type_DESPAWN, e);
+}
+
+void push_command_damage(Entity_Command_Segment *segment, Entity *e, f32 amount) {
+  Entity_Command *cmd = push_entity_command(segment, Entity_Command_Type_DAMAGE, e);
+  cmd->damage.amount = amount;
+}
+
+void push_command_teleport(Entity_Command_Segment *segment, Entity *e, v3 p) {
+  Entity_Command *cmd = push_entity_command(segment, Entity_Command_Type_TELEPORT, e);
+  cmd->teleport.p = p;
 }
 
 
@@ -638,9 +956,17 @@ b32 gjk_collide_point(v2 point, Collider a_coll, Transform a_t) {
   return result;
 }
 
-b32 skill_use(State *state, Entity *e, Skill *skill) {
+b32 skill_use(State *state, Entity_Command_Segment *commands, Rand *rand, 
+              Entity *e, i32 skill_index) {
+  assert(e->skills_index && e->resources_index);
   b32 result = false;
   
+  Skill *skill = state->skills.skills[e->skills_index] + skill_index;
+  f32 *cooldown = state->skills.cooldowns[e->skills_index] + skill_index;
+  f32 *mp = state->resources.mp + e->resources_index;
+  v3 target_p = state->skills.target_p[e->skills_index];
+  v3 p = entity_get_p(state, e);
+  
   f32 cost = skill->mp_cost;
   f32 damage = skill->damage;
   
@@ -656,35 +982,31 @@ b32 skill_use(State *state, Entity *e, Skill *skill) {
     }
   }
   
-  if (skill->cooldown.v <= 0) {
-    if (e->mp.v >= cost) {
-      skill->cooldown.v = skill->cooldown.max;
-      e->mp.v -= cost;
+  if (*cooldown <= 0) {
+    if (*mp >= cost) {
+      *cooldown = skill->cooldown;
+      *mp -= cost;
       result = true;
       switch (skill->type) {
         case Skill_Type_BLINK: {
-          e->t.p = e->target_p;
+          push_command_teleport(commands, e, target_p);
         } break;
         
         case Skill_Type_FIREBALL: {
-          Entity *ball = add_entity_fireball(state);
-          ball->t.p = e->t.p;
-          
-          v2 dir = v2_sub(e->target_p.xy, e->t.p.xy);
+          v2 dir = v2_sub(target_p.xy, p.xy);
           
           f32 target_angle = atan2_f32(dir.y, dir.x);
           f32 spread = (1 - skill->accuracy)*PI;
-          f32 random_angle = random_range(&state->rand, -spread, spread);
+          f32 random_angle = random_range(rand, -spread, spread);
           f32 angle = target_angle + random_angle;
-          ball->t.angle = angle;
           v2 shoot_dir = v2_rotate(v2_right(), angle);
           
-          ball->t.angle = angle;
-          ball->d_p = v2_to_v3(v2_mul(v2_unit(shoot_dir), 5.0f), 0);
-          ball->contact_damage = damage;
-          ball->team = e->team;
-          
-          sound_emitter_add(&state->sound_state, &state->snd_bop, e->t.p);
+          Entity_Command *cmd = push_entity_command(commands, Entity_Command_Type_SPAWN_FIREBALL, e);
+          cmd->spawn_fireball.p = p;
+          cmd->spawn_fireball.d_p = v2_to_v3(v2_mul(v2_unit(shoot_dir), 5.0f), 0);
+          cmd->spawn_fireball.angle = angle;
+          cmd->spawn_fireball.damage = damage;
+          cmd->spawn_fireball.team = e->team;
         } break;
       }
     }
@@ -693,9 +1015,9 @@ b32 skill_use(State *state, Entity *e, Skill *skill) {
   return result;
 }
 
-rect2 get_bbox(Entity *e) {
+rect2 get_bbox(State *state, Entity *e) {
   assert(e->collider.type == Collider_Type_BOX);
-  Polygon poly = aabb_transform(e->collider.box.rect, e->t);
+  Polygon poly = aabb_transform(e->collider.box.rect, entity_get_transform(state, e));
   
   rect2 result = rect2_inverted_infinity();
   for (i32 i = 0; i < poly.count; i++) {
@@ -722,65 +1044,88 @@ Tile_Position get_tile_position(v2 p) {
   return result;
 }
 
-Tile *get_tile(Tile_Map *map, Tile_Position p) {
-  // TODO(lvl5): hashtable
-  Tile_Chunk *chunk = 0;
-  for (u32 i = 0; i < sb_count(map->chunks); i++) {
-    Tile_Chunk *test = map->chunks + i;
-    if (test->x == p.chunk_x && test->y == p.chunk_y) {
-      chunk = test;
+u32 tile_map_get_hash_slot(i32 chunk_x, i32 chunk_y) {
+  u32 hash = (u32)chunk_x*73856093 ^ (u32)chunk_y*19349663;
+  u32 result = hash & (TILE_CHUNK_HASH_SIZE - 1);
+  return result;
+}
+
+void tile_chunk_update_wall_mask(Tile_Chunk *chunk) {
+  assert(CHUNK_SIZE*CHUNK_SIZE == 64);
+  
+  chunk->wall_mask = 0;
+  for (i32 tile_index = 0; tile_index < CHUNK_SIZE*CHUNK_SIZE; tile_index++) {
+    if (chunk->tiles[tile_index].terrain == Terrain_Kind_WALL) {
+      chunk->wall_mask |= 1ull << tile_index;
+    }
+  }
+}
+
+void tile_map_add_chunk(Tile_Map *map, Tile_Chunk chunk) {
+  // NOTE(lvl5): keep the load factor low so probe chains stay short
+  assert(sb_count(map->chunks) < TILE_CHUNK_HASH_SIZE/2);
+  
+  u32 slot = tile_map_get_hash_slot(chunk.x, chunk.y);
+  while (map->chunk_hash[slot]) {
+    Tile_Chunk *test = map->chunks + map->chunk_hash[slot] - 1;
+    assert(test->x != chunk.x || test->y != chunk.y);
+    slot = (slot + 1) & (TILE_CHUNK_HASH_SIZE - 1);
+  }
+  
+  tile_chunk_update_wall_mask(&chunk);
+  sb_push(map->chunks, chunk);
+  map->chunk_hash[slot] = sb_count(map->chunks);
+}
+
+Tile_Chunk *tile_map_get_chunk(Tile_Map *map, i32 chunk_x, i32 chunk_y) {
+  Tile_Chunk *result = 0;
+  
+  u32 slot = tile_map_get_hash_slot(chunk_x, chunk_y);
+  while (map->chunk_hash[slot]) {
+    Tile_Chunk *test = map->chunks + map->chunk_hash[slot] - 1;
+    if (test->x == chunk_x && test->y == chunk_y) {
+      result = test;
       break;
     }
+    slot = (slot + 1) & (TILE_CHUNK_HASH_SIZE - 1);
   }
+  
+  return result;
+}
+
+Tile *get_tile(Tile_Map *map, Tile_Position p) {
+  Tile_Chunk *chunk = tile_map_get_chunk(map, p.chunk_x, p.chunk_y);
   assert(chunk);
   Tile *result = chunk->tiles + p.tile_y*CHUNK_SIZE + p.tile_x;
   return result;
 }
 
 Entity *query_entity_id(State *state, i32 id) {
+  Entity_Slot_Map *map = &state->entities;
   Entity *result = null;
-  for (i32 i = 1; i < state->entity_count; i++) {
-    Entity *e = get_entity(state, i);
-    if (e && e->id == id) {
-      result = e;
+  
+  i32 index = id & ENTITY_INDEX_MASK;
+  if (index > 0 && index < map->slot_count) {
+    Entity *test = map->slots + index;
+    if (test->is_active && test->id == id) {
+      result = test;
     }
   }
   return result;
 }
 
 Entity *query_entity_handle(State *state, Entity_Handle handle) {
-  Entity *result = 0;
-  Entity *test = get_entity(state, handle.index);
-  if (test && test->id == handle.id) {
-    result = test;
-  }
-  
-  return result;
-}
-
-Entity **query_entities_flag(State *state, Entity_Flag flag) {
-  push_scratch_context();
-  Entity **result = sb_new(Entity *, 32);
-  pop_context();
-  
-  for (i32 i = 1; i < state->entity_count; i++) {
-    Entity *e = get_entity(state, i);
-    if (e && flag_is_set(e->flags, flag)) {
-      sb_push(result, e);
-    }
-  }
-  
+  Entity *result = query_entity_id(state, handle.id);
   return result;
 }
 
 Entity *query_closest_entity_flag(State *state, Entity_Flag flag, v3 p) {
-  Entity **list = query_entities_flag(state, flag);
-  
   Entity *result = 0;
   f32 min_dist = INFINITY;
-  for (u32 i = 0; i < sb_count(list); i++) {
-    Entity *e = list[i];
-    f32 dist = v3_length_sqr(v3_sub(e->t.p, p));
+  for (Entity_Iterator it = iterate_entities_flag(state, flag);
+       entity_iterator_next(state, &it);) {
+    Entity *e = it.e;
+    f32 dist = v3_length_sqr(v3_sub(entity_get_p(state, e), p));
     if (dist < min_dist) {
       result = e;
       min_dist = dist;
@@ -839,92 +1184,817 @@ Collision collide_aabb_aabb(rect2 a, rect2 b) {
 }
 
 
-Entity **query_entities_collide(State *state, Entity *a_ent) {
-  push_scratch_context();
-  Entity **result = sb_new(Entity *, 32);
-  pop_context();
+// NOTE(lvl5): all coordinates are inclusive local tile coordinates
+u64 tile_chunk_get_footprint_mask(i32 min_x, i32 min_y, i32 max_x, i32 max_y) {
+  u64 row = ((1ull << (max_x - min_x + 1)) - 1) << min_x;
+  u64 rows = (~0ull >> (64 - (max_y - min_y + 1)*CHUNK_SIZE)) << (min_y*CHUNK_SIZE);
+  u64 result = (row*CHUNK_ROW_REPLICATE) & rows;
+  return result;
+}
+
+void entity_collide_tiles(State *state, Entity *e) {
+  rect2 bbox = get_bbox(state, e);
+  v3 *p = state->motion.p + e->motion_index;
+  v3 *d_p = state->motion.d_p + e->motion_index;
+  
+  Tile_Position min_p = get_tile_position(bbox.min);
+  Tile_Position max_p = get_tile_position(bbox.max);
+  i32 min_tile_x = min_p.chunk_x*CHUNK_SIZE + min_p.tile_x;
+  i32 min_tile_y = min_p.chunk_y*CHUNK_SIZE + min_p.tile_y;
+  i32 max_tile_x = max_p.chunk_x*CHUNK_SIZE + max_p.tile_x;
+  i32 max_tile_y = max_p.chunk_y*CHUNK_SIZE + max_p.tile_y;
+  
+  for (i32 chunk_y = min_p.chunk_y; chunk_y <= max_p.chunk_y; chunk_y++) {
+    for (i32 chunk_x = min_p.chunk_x; chunk_x <= max_p.chunk_x; chunk_x++) {
+      Tile_Chunk *chunk = tile_map_get_chunk(&state->tile_map, chunk_x, chunk_y);
+      if (!chunk) continue;
+      
+      i32 chunk_tile_x = chunk_x*CHUNK_SIZE;
+      i32 chunk_tile_y = chunk_y*CHUNK_SIZE;
+      u64 footprint = tile_chunk_get_footprint_mask(
+        clamp_i32(min_tile_x - chunk_tile_x, 0, CHUNK_SIZE - 1),
+        clamp_i32(min_tile_y - chunk_tile_y, 0, CHUNK_SIZE - 1),
+        clamp_i32(max_tile_x - chunk_tile_x, 0, CHUNK_SIZE - 1),
+        clamp_i32(max_tile_y - chunk_tile_y, 0, CHUNK_SIZE - 1));
+      
+      u64 hits = chunk->wall_mask & footprint;
+      while (hits) {
+        u32 bit = bit_scan_forward_u64(hits);
+        hits &= hits - 1;
+        
+        v2 world_p = V2((f32)(chunk_tile_x + bit % CHUNK_SIZE)*TILE_SIZE_IN_METERS,
+                        (f32)(chunk_tile_y + bit / CHUNK_SIZE)*TILE_SIZE_IN_METERS);
+        rect2 wall_bbox = rect2_center_size(world_p, V2(1, 1));
+        
+        // NOTE(lvl5): resolve every overlapped wall, so big entities
+        // get pushed out of all the tiles they cover
+        Collision col = collide_aabb_aabb(bbox, wall_bbox);
+        if (col.success) {
+          *p = v3_add(*p, v2_to_v3(col.proj, 0));
+          bbox.min = v2_add(bbox.min, col.proj);
+          bbox.max = v2_add(bbox.max, col.proj);
+          if (col.proj.x) {
+            d_p->x = 0;
+          } else {
+            d_p->y = 0;
+          }
+        }
+      }
+    }
+  }
+}
+
+i32 entity_grid_get_cell(f32 coord) {
+  i32 result = floor_f32_i32(coord/ENTITY_GRID_CELL_SIZE);
+  return result;
+}
+
+u32 entity_grid_get_bucket(i32 cell_x, i32 cell_y) {
+  u32 hash = (u32)cell_x*73856093 ^ (u32)cell_y*19349663;
+  u32 result = hash & (ENTITY_GRID_BUCKET_COUNT - 1);
+  return result;
+}
+
+void entity_grid_insert(Entity_Grid *grid, i32 entity_index, rect2 bbox) {
+  i32 min_x = entity_grid_get_cell(bbox.min.x);
+  i32 min_y = entity_grid_get_cell(bbox.min.y);
+  i32 max_x = entity_grid_get_cell(bbox.max.x);
+  i32 max_y = entity_grid_get_cell(bbox.max.y);
+  
+  for (i32 cell_y = min_y; cell_y <= max_y; cell_y++) {
+    for (i32 cell_x = min_x; cell_x <= max_x; cell_x++) {
+      assert(grid->node_count < array_count(grid->nodes));
+      u32 bucket = entity_grid_get_bucket(cell_x, cell_y);
+      
+      i32 node_index = grid->node_count++;
+      Entity_Grid_Node *node = grid->nodes + node_index;
+      node->entity_index = entity_index;
+      node->cell_x = cell_x;
+      node->cell_y = cell_y;
+      node->next = grid->buckets[bucket];
+      grid->buckets[bucket] = node_index;
+    }
+  }
+}
+
+void entity_grid_build(State *state) {
+  DEBUG_FUNCTION_BEGIN();
+  
+  Entity_Grid *grid = &state->entity_grid;
+  zero_memory_slow(grid->buckets, sizeof(grid->buckets));
+  grid->node_count = 1;
+  
+  Entity_Slot_Map *map = &state->entities;
+  for (i32 live_index = 0; live_index < map->live_count; live_index++) {
+    Entity *e = map->slots + map->live[live_index];
+    if (e->is_active) {
+      entity_grid_insert(grid, e->index, get_bbox(state, e));
+    }
+  }
+  
+  DEBUG_FUNCTION_END();
+}
+
+// NOTE(lvl5): returns how many entities collide, which can be more than
+// result_capacity. Only the first result_capacity of them are written,
+// query again with more room to get the rest
+i32 query_entities_collide(State *state, Entity *a_ent, 
+                           Entity **result, i32 result_capacity) {
+  Entity_Grid *grid = &state->entity_grid;
+  
+  // NOTE(lvl5): an entity can sit in several cells, the stamp makes sure
+  // it is only tested once per query
+  grid->query_stamp++;
+  if (grid->query_stamp == 0) {
+    zero_memory_slow(grid->query_stamps, sizeof(grid->query_stamps));
+    grid->query_stamp = 1;
+  }
   
-  for (i32 i = 1; i < state->entity_count; i++) {
-    Entity *e = get_entity(state, i);
-    if (e) {
-      rect2 a = get_bbox(a_ent);
-      rect2 b = get_bbox(e);
-      Collision collision = collide_aabb_aabb(a, b);
-      if (collision.success) {
-        sb_push(result, e);
+  rect2 a = get_bbox(state, a_ent);
+  i32 min_x = entity_grid_get_cell(a.min.x - ENTITY_GRID_QUERY_MARGIN);
+  i32 min_y = entity_grid_get_cell(a.min.y - ENTITY_GRID_QUERY_MARGIN);
+  i32 max_x = entity_grid_get_cell(a.max.x + ENTITY_GRID_QUERY_MARGIN);
+  i32 max_y = entity_grid_get_cell(a.max.y + ENTITY_GRID_QUERY_MARGIN);
+  
+  i32 result_count = 0;
+  for (i32 cell_y = min_y; cell_y <= max_y; cell_y++) {
+    for (i32 cell_x = min_x; cell_x <= max_x; cell_x++) {
+      u32 bucket = entity_grid_get_bucket(cell_x, cell_y);
+      
+      for (i32 node_index = grid->buckets[bucket];
+           node_index;
+           node_index = grid->nodes[node_index].next) {
+        Entity_Grid_Node *node = grid->nodes + node_index;
+        if (node->cell_x != cell_x || node->cell_y != cell_y) continue;
+        if (node->entity_index == a_ent->index) continue;
+        if (grid->query_stamps[node->entity_index] == grid->query_stamp) continue;
+        grid->query_stamps[node->entity_index] = grid->query_stamp;
+        
+        Entity *e = get_entity(state, node->entity_index);
+        if (e) {
+          rect2 b = get_bbox(state, e);
+          Collision collision = collide_aabb_aabb(a, b);
+          if (collision.success) {
+            if (result_count < result_capacity) {
+              result[result_count] = e;
+            }
+            result_count++;
+          }
+        }
       }
     }
   }
   
-  return result;
+  return result_count;
 }
 
 
 void entity_take_damage(State *state, Entity *e, f32 damage) {
   // TODO(lvl5): damage types, resistances, etc
-  e->hp.v -= damage;
-  if (e->hp.v <= 0) {
+  if (!e->resources_index) return;
+  
+  f32 *hp = state->resources.hp + e->resources_index;
+  *hp -= damage;
+  if (*hp <= 0) {
     remove_entity(state, e);
   }
 }
 
-
-extern GAME_UPDATE(game_update) {
-  State *state = (State *)memory.perm;
-  debug_state = (Debug_State *)memory.debug;
-  Arena *arena = &state->arena;
-  
-  if (memory.is_reloaded) {
-    // NOTE(lvl5): transient memory can be destroyed at this point
-    global_context_info = memory.global_context_info;
-    platform = _platform;
-    gl = _platform.gl;
-    scratch = &state->scratch;
+void entity_command_segment_apply(State *state, Entity_Command_Segment *segment) {
+  for (Entity_Command_Segment *block = segment; block; block = block->next) {
+    for (i32 cmd_index = 0; cmd_index < block->count; cmd_index++) {
+      Entity_Command *cmd = block->commands + cmd_index;
+      // NOTE(lvl5): the entity could have died earlier in this pass
+      Entity *e = query_entity_id(state, cmd->entity_id);
     
-#define SCRATCH_SIZE megabytes(10)
-    arena_init(&state->scratch, memory.temp, SCRATCH_SIZE);
-    arena_init(&state->temp, memory.temp + SCRATCH_SIZE, 
-               memory.temp_size - SCRATCH_SIZE);
+      switch (cmd->type) {
+        case Entity_Command_Type_SPAWN_FIREBALL: {
+          // NOTE(lvl5): a dead caster's fireball still flies
+          Entity *ball = add_entity_fireball(state);
+          entity_set_p(state, ball, cmd->spawn_fireball.p);
+          state->motion.d_p[ball->motion_index] = cmd->spawn_fireball.d_p;
+          ball->angle = cmd->spawn_fireball.angle;
+          ball->contact_damage = cmd->spawn_fireball.damage;
+          ball->team = cmd->spawn_fireball.team;
+        
+          sound_emitter_add(&state->sound_state, &state->snd_bop, cmd->spawn_fireball.p);
+        } break;
+      
+        case Entity_Command_Type_DESPAWN: {
+          if (e) remove_entity(state, e);
+        } break;
+      
+        case Entity_Command_Type_DAMAGE: {
+          if (e) entity_take_damage(state, e, cmd->damage.amount);
+        } break;
+      
+        case Entity_Command_Type_TELEPORT: {
+          if (e) entity_set_p(state, e, cmd->teleport.p);
+        } break;
+      
+        default: assert(false);
+      }
+    }
   }
-  
-  if (!state->is_initialized) {
-    arena_init(&state->arena, memory.perm + sizeof(State), 
-               memory.perm_size - sizeof(State));
-    
-    debug_init(memory.debug + sizeof(Debug_State));
-    
-    // NOTE(lvl5): when live reloading, the sound files can be overwritten
-    // with garbage since it's located in temp arena right now
-    state->test_sound = load_wav(&state->temp, const_string("sounds/durarara.wav"));
-    //sound_play(&state->sound_state, &state->test_sound, Sound_Type_MUSIC);
-    state->snd_bop = load_wav(&state->temp, const_string("sounds/bop.wav"));
+  segment->count = 0;
+  segment->next = 0;
+  segment->tail = 0;
+}
+
+void entity_commands_apply(State *state) {
+  DEBUG_FUNCTION_BEGIN();
+  Entity_Command_Buffer *buffer = &state->entity_commands;
+  for (i32 segment_index = 0; segment_index < ENTITY_COMMAND_SEGMENT_COUNT; segment_index++) {
+    entity_command_segment_apply(state, buffer->segments + segment_index);
+  }
+  DEBUG_FUNCTION_END();
+}
+
+
+// NOTE(lvl5): entity systems. Each one is a pass over one component table,
+// the flat ones treat the SoA arrays as plain float arrays.
+// The batched systems run on the high priority queue. A batch only writes
+// the components in its own range, everything else goes through its
+// command segment, and it can't use the debug system or allocate.
+
+typedef struct {
+  State *state;
+  i32 begin;
+  i32 end;
+  f32 dt;
+  Rand rand;
+  Entity_Command_Segment *commands;
+} Entity_Batch;
+
+#define ENTITY_BATCH_COUNT (ENTITY_COMMAND_SEGMENT_COUNT - 1)
+#define ENTITY_MIN_BATCH_SIZE 256
+
+// NOTE(lvl5): the split only depends on the table size, and batch i always
+// gets command segment i+1 and the same random seed, so the outcome 
+// doesn't depend on which thread ran what
+void run_entity_batches(State *state, Worker_Fn *fn, i32 table_count, f32 dt) {
+  Entity_Batch batches[ENTITY_BATCH_COUNT];
+  
+  i32 component_count = table_count - 1;
+  i32 batch_size = (component_count + ENTITY_BATCH_COUNT - 1)/ENTITY_BATCH_COUNT;
+  if (batch_size < ENTITY_MIN_BATCH_SIZE) {
+    batch_size = ENTITY_MIN_BATCH_SIZE;
+  }
+  // NOTE(lvl5): one command per entity at most, see Entity_Command_Segment
+  assert(batch_size <= ENTITY_COMMAND_SEGMENT_SIZE);
+  
+  i32 batch_count = 0;
+  for (i32 begin = 1; begin < table_count; begin += batch_size) {
+    Entity_Batch *batch = batches + batch_count;
+    batch->state = state;
+    batch->begin = begin;
+    batch->end = begin + batch_size;
+    if (batch->end > table_count) {
+      batch->end = table_count;
+    }
+    batch->dt = dt;
+    batch->rand = make_random_sequence(state->tick_count*2654435761u + batch_count*40503u + 1);
+    batch->commands = state->entity_commands.segments + batch_count + 1;
     
-    debug_add_arena(&state->arena, const_string("main"));
-    debug_add_arena(&state->temp, const_string("temp"));
-    debug_add_arena(&debug_state->arena, const_string("debug_main"));
-    debug_add_arena(&debug_state->gui.arena, const_string("debug_gui"));
+    platform.add_work_queue_entry(platform.high_queue, fn, batch);
+    batch_count++;
   }
   
-  if (!state->is_initialized) {
-    push_arena_context(&state->arena);
-    
-    sound_init(&state->sound_state);
-    
-    debug_state->gui.selected_frame_index = -1;
-    
-    state->frame_count = 0;
-    state->rand = make_random_sequence(2312323342);
-    
-    // NOTE(lvl5): font stuff
+  platform.complete_all_work(platform.high_queue);
+}
+
+WORKER_FN(motion_integrate_batch) {
+  Entity_Batch *batch = (Entity_Batch *)data;
+  Motion_Table *motion = &batch->state->motion;
+  
+  assert(sizeof(v3) == 3*sizeof(f32));
+  f32 *p = (f32 *)motion->p;
+  f32 *prev_p = (f32 *)motion->prev_p;
+  f32 *d_p = (f32 *)motion->d_p;
+  f32 dt = batch->dt;
+  for (i32 i = batch->begin*3; i < batch->end*3; i++) {
+    prev_p[i] = p[i];
+    p[i] += d_p[i]*dt;
+  }
+}
+
+WORKER_FN(skill_cooldowns_batch) {
+  Entity_Batch *batch = (Entity_Batch *)data;
+  Skill_Table *skills = &batch->state->skills;
+  
+  f32 *cooldowns = (f32 *)skills->cooldowns;
+  f32 dt = batch->dt;
+  for (i32 i = batch->begin*SKILL_SLOT_COUNT; i < batch->end*SKILL_SLOT_COUNT; i++) {
+    cooldowns[i] -= dt;
+  }
+}
+
+void player_update(State *state, Entity_Command_Segment *commands, 
+                   Input *input, v2 mouse_world) {
+  DEBUG_FUNCTION_BEGIN();
+  for (Entity_Iterator it = iterate_entities_flag(state, Entity_Flag_PLAYER);
+       entity_iterator_next(state, &it);) {
+    Entity *e = it.e;
+    if (e->controller_type != Controller_Type_PLAYER) continue;
     
-    //state->font = load_ttf(state, platform, const_string("Gugi-Regular.ttf"));
-    state->font = load_ttf(const_string("fonts/arial.ttf"));
+    state->skills.target_p[e->skills_index] = v2_to_v3(mouse_world, 0);
+    state->motion.move_dir[e->motion_index] = 
+      v2_i(input->move_right.is_down - input->move_left.is_down,
+           input->move_up.is_down - input->move_down.is_down);
     
-    Buffer shader_src = platform.read_entire_file(const_string("shaders/textured_quad.glsl"));
-    gl_Parse_Result sources = gl_parse_glsl(buffer_to_string(shader_src));
+    for (i32 skill_index = 0; 
+         skill_index < SKILL_SLOT_COUNT;
+         skill_index++) {
+      Button btn = input->skills[skill_index];
+      if (btn.went_up) {
+        b32 use_success = skill_use(state, commands, &state->rand, e, skill_index);
+      }
+    }
+  }
+  DEBUG_FUNCTION_END();
+}
+
+WORKER_FN(ai_update_batch) {
+  Entity_Batch *batch = (Entity_Batch *)data;
+  State *state = batch->state;
+  Entity_Command_Segment *commands = batch->commands;
+  Rand *rand = &batch->rand;
+  f32 dt = batch->dt;
+  
+  Ai_Table *ai = &state->ai;
+  for (i32 ai_index = batch->begin; ai_index < batch->end; ai_index++) {
+    Entity *e = state->entities.slots + ai->entity_index[ai_index];
+    if (!e->is_active) continue;
     
-    state->shader_basic = gl_create_shader(&state->arena, gl, sources.vertex, sources.fragment);
-    state->atlas = make_texture_atlas_from_folder(const_string("sprites"));
+    v3 p = entity_get_p(state, e);
+    v3 *target_p = state->skills.target_p + e->skills_index;
+    
+    switch (ai->state[ai_index]) {
+      case Ai_State_IDLE: {
+        f32 move_radius = 5.0f;
+        ai->target_move_p[ai_index] = V3(random_range(rand, -move_radius, move_radius),
+                                         random_range(rand, -move_radius, move_radius),
+                                         0);
+        ai->target_move_p[ai_index] = v3_add(p, ai->target_move_p[ai_index]);
+        
+        if (ai->progress[ai_index] < 1) {
+          ai->progress[ai_index] += 1.2f*dt;
+        } else {
+          ai->progress[ai_index] = 0;
+          ai->state[ai_index] = Ai_State_WALK_TO;
+        }
+      } break;
+      
+      case Ai_State_WALK_TO: {
+        Entity *target = query_closest_entity_flag(state, Entity_Flag_PLAYER, p);
+        if (target && v3_length(v3_sub(entity_get_p(state, target), p)) < 5) {
+          ai->state[ai_index] = Ai_State_ALERT;
+          ai->aggro_handle[ai_index] = get_entity_handle(target);
+          break;
+        }
+        
+        if (v3_length_sqr(v3_sub(p, ai->target_move_p[ai_index])) < 1.0f) {
+          ai->state[ai_index] = Ai_State_IDLE;
+        } else {
+          state->motion.move_dir[e->motion_index] = v2_sub(ai->target_move_p[ai_index].xy, p.xy);
+        }
+      } break;
+      
+      case Ai_State_ALERT: {
+        Entity *target = query_entity_handle(state, ai->aggro_handle[ai_index]);
+        if (target) {
+          if (v3_length(v3_sub(entity_get_p(state, target), p)) > 8) {
+            ai->aggro_handle[ai_index] = NULL_ENTITY_HANDLE;
+            ai->state[ai_index] = Ai_State_IDLE;
+            break;
+          }
+          
+          if (state->skills.cooldowns[e->skills_index][0] <= 0) {
+            ai->state[ai_index] = Ai_State_TELE;
+            break;
+          }
+        } else {
+          ai->state[ai_index] = Ai_State_IDLE;
+        }
+      } break;
+      
+      case Ai_State_TELE: {
+        if (ai->progress[ai_index] < 1) {
+          ai->progress[ai_index] += 3.6f*dt;
+          Entity *target = query_entity_handle(state, ai->aggro_handle[ai_index]);
+          if (target) {
+            *target_p = entity_get_p(state, target);
+          }
+        } else {
+          ai->progress[ai_index] = 0;
+          ai->state[ai_index] = Ai_State_ATTACK;
+        }
+      } break;
+      
+      case Ai_State_ATTACK: {
+        Entity *target = query_entity_handle(state, ai->aggro_handle[ai_index]);
+        if (target) {
+          *target_p = entity_get_p(state, target);
+          skill_use(state, commands, rand, e, 0);
+          ai->state[ai_index] = Ai_State_ALERT;
+        }
+      } break;
+      
+      default: assert(false);
+    }
+  }
+}
+
+WORKER_FN(motion_apply_controls_batch) {
+  Entity_Batch *batch = (Entity_Batch *)data;
+  Motion_Table *motion = &batch->state->motion;
+  // NOTE(lvl5): speed and friction are per reference tick
+  f32 tick_scale = batch->dt*SIM_REFERENCE_RATE;
+  for (i32 i = batch->begin; i < batch->end; i++) {
+    v2 move_dir = motion->move_dir[i];
+    f32 move_dir_len = v2_length(move_dir);
+    if (move_dir_len) {
+      move_dir = v2_div(move_dir, move_dir_len);
+    }
+    v2 d_d_p = v2_mul(move_dir, motion->speed[i]*tick_scale);
+    motion->d_p[i] = v3_add(motion->d_p[i], v2_to_v3(d_d_p, 0));
+    motion->d_p[i] = v3_mul(motion->d_p[i], powf(motion->friction[i], tick_scale));
+    motion->move_dir[i] = v2_zero();
+  }
+}
+
+void contact_damage_update(State *state, Entity_Command_Segment *commands) {
+  DEBUG_FUNCTION_BEGIN();
+  Entity_Slot_Map *map = &state->entities;
+  for (i32 live_index = 0; live_index < map->live_count; live_index++) {
+    Entity *e = map->slots + map->live[live_index];
+    if (!e->is_active || !e->contact_damage) continue;
+    
+    Entity *collide_buffer[256];
+    Entity **collide_list = collide_buffer;
+    i32 collide_count = query_entities_collide(state, e, collide_list,
+                                               array_count(collide_buffer));
+    if (collide_count > array_count(collide_buffer)) {
+      // NOTE(lvl5): dense cluster, scratch is reset at the end of the frame
+      collide_list = arena_push_array(&state->scratch, Entity *, collide_count);
+      i32 requery_count = query_entities_collide(state, e, collide_list, collide_count);
+      assert(requery_count == collide_count);
+    }
+    for (i32 i = 0; i < collide_count; i++) {
+      Entity *other = collide_list[i];
+      
+      if (other->team != e->team &&
+          !flag_is_set(other->flags, Entity_Flag_PROJECTILE)) {
+        
+        b32 already_hit = false;
+        for (u32 pen_index = 0; pen_index < sb_count(e->penetrating_projectile.penetrated_entity_ids); pen_index++) {
+          i32 id = e->penetrating_projectile.penetrated_entity_ids[pen_index];
+          if (id == other->id) {
+            already_hit = true;
+          }
+        }
+        
+        if (already_hit) continue;
+        push_command_damage(commands, other, e->contact_damage);
+        
+        if (flag_is_set(e->flags, Entity_Flag_PROJECTILE)) {
+          sb_push(e->penetrating_projectile.penetrated_entity_ids, other->id);
+        }
+        
+#if 0
+        if (flag_is_set(e->flags, Entity_Flag_PROJECTILE)) {
+          remove_entity(state, e->index);
+        }
+#endif
+      }
+    }
+  }
+  DEBUG_FUNCTION_END();
+}
+
+WORKER_FN(tile_collision_batch) {
+  Entity_Batch *batch = (Entity_Batch *)data;
+  State *state = batch->state;
+  Motion_Table *motion = &state->motion;
+  for (i32 i = batch->begin; i < batch->end; i++) {
+    Entity *e = state->entities.slots + motion->entity_index[i];
+    if (!e->is_active) continue;
+    entity_collide_tiles(state, e);
+  }
+}
+
+void lifetime_update(State *state, Entity_Command_Segment *commands, f32 dt) {
+  DEBUG_FUNCTION_BEGIN();
+  Lifetime_Table *lifetimes = &state->lifetimes;
+  for (i32 i = 1; i < lifetimes->count; i++) {
+    lifetimes->time[i] -= dt;
+  }
+  
+  for (i32 i = 1; i < lifetimes->count; i++) {
+    if (lifetimes->time[i] <= 0) {
+      push_command_despawn(commands, state->entities.slots + lifetimes->entity_index[i]);
+    }
+  }
+  DEBUG_FUNCTION_END();
+}
+
+WORKER_FN(resource_regen_batch) {
+  Entity_Batch *batch = (Entity_Batch *)data;
+  Resource_Table *res = &batch->state->resources;
+  f32 dt = batch->dt;
+  for (i32 i = batch->begin; i < batch->end; i++) {
+    f32 hp = res->hp[i] + res->hp_regen[i]*dt;
+    f32 mp = res->mp[i] + res->mp_regen[i]*dt;
+    res->hp[i] = hp < res->hp_max[i] ? hp : res->hp_max[i];
+    res->mp[i] = mp < res->mp_max[i] ? mp : res->mp_max[i];
+  }
+}
+
+void entities_draw(State *state, Render_Group *group, f32 alpha) {
+  DEBUG_FUNCTION_BEGIN();
+  Entity_Slot_Map *map = &state->entities;
+  for (i32 live_index = 0; live_index < map->live_count; live_index++) {
+    Entity *e = map->slots + map->live[live_index];
+    if (!e->is_active) continue;
+    
+#if 1
+    if (flag_is_set(e->flags, Entity_Flag_ACTOR)) {
+      // NOTE(lvl5): draw hp and mp
+      String hp_string = tsprintf("HP: %.02f", state->resources.hp[e->resources_index]);
+      f32 hp_string_width = font_get_text_width_meters(group->state.font, hp_string);
+      
+      String mp_string = tsprintf("MP: %.02f", state->resources.mp[e->resources_index]);
+      
+      String ai_string = tsprintf("AI: %s %0.0f%%", 
+                                  Ai_State_to_string[state->ai.state[e->ai_index]],
+                                  state->ai.progress[e->ai_index]*100);
+      
+      render_save(group);
+      render_color(group, V4(0, 0, 0, 1));
+      render_translate(group, v3_add(entity_get_render_p(state, e, alpha), V3(-hp_string_width*0.5f, 0.05f*PIXELS_PER_METER, 0)));
+      push_text(group, hp_string);
+      
+      render_translate(group, V3(0, -0.015f*PIXELS_PER_METER, 0));
+      push_text(group, mp_string);
+      
+      render_translate(group, V3(0, -0.015f*PIXELS_PER_METER, 0));
+      push_text(group, ai_string);
+      
+      render_restore(group);
+    }
+#endif
+    if (state->ai.state[e->ai_index] == Ai_State_WALK_TO) {
+      render_save(group);
+      render_color(group, V4(1, 0, 0, 1));
+      
+      push_rect(group, rect2_center_size(state->ai.target_move_p[e->ai_index].xy, V2(0.4f, 0.4f)));
+      render_restore(group);
+    }
+    
+    Transform t = entity_get_transform(state, e);
+    t.p = entity_get_render_p(state, e, alpha);
+    render_save(group);
+    render_transform(group, t);
+    
+    if (debug_get_var_i32(Debug_Var_Name_COLLIDERS)) {
+      switch (e->collider.type) {
+        case Collider_Type_BOX: {
+#if 0
+          render_rotate(group, 0.1f);
+          render_scale(group, V3(7, 7, 1));
+          push_rect(group, e->collider.box.rect);
+#endif
+          push_rect_outline(group, e->collider.box.rect, 0.04f);
+        } break;
+        case Collider_Type_CIRCLE: {
+          Circle_Collider coll = e->collider.circle;
+          push_circle_outline(group, coll.origin, coll.r, 0.04f);
+        } break;
+        default: assert(false);
+      }
+    }
+    render_restore(group);
+  }
+  DEBUG_FUNCTION_END();
+}
+
+void button_latch(Button *latched, Button b) {
+  latched->is_down = b.is_down;
+  latched->went_down |= b.went_down;
+  latched->went_up |= b.went_up;
+  latched->pressed |= b.pressed;
+}
+
+void button_clear_edges(Button *b) {
+  b->went_down = false;
+  b->went_up = false;
+  b->pressed = false;
+}
+
+void input_latch(Input *latched, Input *input) {
+  for (i32 button_index = 0; button_index < array_count(input->buttons); button_index++) {
+    button_latch(latched->buttons + button_index, input->buttons[button_index]);
+  }
+  for (i32 key_index = 0; key_index < array_count(input->keys); key_index++) {
+    button_latch(latched->keys + key_index, input->keys[key_index]);
+  }
+  button_latch(&latched->mouse.left, input->mouse.left);
+  button_latch(&latched->mouse.right, input->mouse.right);
+  latched->mouse.p = input->mouse.p;
+  latched->mouse.scroll += input->mouse.scroll;
+  if (input->char_code) {
+    latched->char_code = input->char_code;
+  }
+}
+
+void input_clear_edges(Input *input) {
+  for (i32 button_index = 0; button_index < array_count(input->buttons); button_index++) {
+    button_clear_edges(input->buttons + button_index);
+  }
+  for (i32 key_index = 0; key_index < array_count(input->keys); key_index++) {
+    button_clear_edges(input->keys + key_index);
+  }
+  button_clear_edges(&input->mouse.left);
+  button_clear_edges(&input->mouse.right);
+  input->mouse.scroll = 0;
+  input->char_code = 0;
+}
+
+void simulate_tick(State *state, Input *input, v2 mouse_world, f32 dt) {
+  DEBUG_FUNCTION_BEGIN();
+  
+  entity_grid_build(state);
+  
+  // NOTE(lvl5): the simulation doesn't spawn or kill anything directly,
+  // it records commands that are applied after all the systems ran
+  Entity_Command_Segment *commands = state->entity_commands.segments + 0;
+  commands->overflow_arena = &state->scratch;
+  
+  run_entity_batches(state, motion_integrate_batch, state->motion.count, dt);
+  run_entity_batches(state, skill_cooldowns_batch, state->skills.count, dt);
+  player_update(state, commands, input, mouse_world);
+  run_entity_batches(state, ai_update_batch, state->ai.count, dt);
+  run_entity_batches(state, motion_apply_controls_batch, state->motion.count, dt);
+  contact_damage_update(state, commands);
+  run_entity_batches(state, tile_collision_batch, state->motion.count, dt);
+  lifetime_update(state, commands, dt);
+  run_entity_batches(state, resource_regen_batch, state->resources.count, dt);
+  
+  entity_commands_apply(state);
+  // NOTE(lvl5): the next tick shouldn't walk over what died in this one
+  entity_slot_map_collect_dead(state);
+  state->tick_count++;
+  
+  DEBUG_FUNCTION_END();
+}
+
+
+// NOTE(lvl5): the parts of initialization that don't survive in perm
+// from one process to the next
+void gpu_and_temp_init(State *state) {
+  Buffer shader_src = platform.read_entire_file(const_string("shaders/textured_quad.glsl"));
+  gl_Parse_Result sources = gl_parse_glsl(buffer_to_string(shader_src));
+  
+  state->shader_basic = gl_create_shader(&state->temp, gl, sources.vertex, sources.fragment);
+  
+  gl.Enable(GL_BLEND);
+  gl.BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  
+  quad_renderer_init(state->renderer, state);
+  
+  particle_emitter_init(&state->temp, &state->test_particle_emitter, state->spr_robot_eye, 1000000);
+  particle_system_init(&state->particle_system);
+  particle_system_add_emitter(&state->particle_system, &state->test_particle_emitter);
+}
+
+// NOTE(lvl5): the globals of a freshly loaded library are empty
+void game_reload(State *state, Memory memory, Platform _platform) {
+  // NOTE(lvl5): transient memory can be destroyed at this point
+  global_context_info = memory.global_context_info;
+  platform = _platform;
+  gl = _platform.gl;
+  scratch = &state->scratch;
+  
+#define SCRATCH_SIZE megabytes(10)
+  // NOTE(lvl5): the arenas start over, but the memory under them is
+  // still there, and so is the renderer in front of them
+  Mem_Size renderer_size = (sizeof(Quad_Renderer) + 63) & ~(Mem_Size)63;
+  state->renderer = (Quad_Renderer *)memory.temp;
+  byte *temp = memory.temp + renderer_size;
+  Mem_Size temp_size = memory.temp_size - renderer_size;
+  arena_init(&state->scratch, temp, SCRATCH_SIZE);
+  arena_init(&state->temp, temp + SCRATCH_SIZE, temp_size - SCRATCH_SIZE);
+}
+
+// NOTE(lvl5): everything in a frame that touches perm. game_simulate runs
+// only this, so it can't draw, mix sound or read anything outside perm
+// other than the debug vars. Returns how far rendering is between ticks
+f32 game_simulate_frame(State *state, v2 screen_size, Input *input, f32 dt) {
+  state->camera.far = 10.0f;
+  state->camera.near = 0.0f;
+  state->camera.scale = V2(1.0f/PIXELS_PER_METER, 1.0f/PIXELS_PER_METER);
+  
+  v2 mouse_meters = get_mouse_p_meters(input, screen_size);
+  v2 mouse_world = v2_add(state->camera.p.xy, mouse_meters);
+  
+  // NOTE(lvl5): dt is the real frame time, the simulation catches up 
+  // in fixed ticks and rendering interpolates between the last two
+  input_latch(&state->tick_input, input);
+  
+  i32 tick_rate = debug_get_var_i32(Debug_Var_Name_TICK_RATE);
+  if (tick_rate < 1) tick_rate = 1;
+  f32 tick_dt = 1.0f/(f32)tick_rate;
+  
+  state->tick_accumulator += dt;
+  i32 ticks_this_frame = 0;
+  while (state->tick_accumulator >= tick_dt) {
+    if (ticks_this_frame == SIM_MAX_TICKS_PER_FRAME) {
+      state->tick_accumulator = 0;
+      break;
+    }
+    simulate_tick(state, &state->tick_input, mouse_world, tick_dt);
+    input_clear_edges(&state->tick_input);
+    state->tick_accumulator -= tick_dt;
+    ticks_this_frame++;
+  }
+  f32 alpha = state->tick_accumulator/tick_dt;
+  
+  for (Entity_Iterator it = iterate_entities_flag(state, Entity_Flag_PLAYER);
+       entity_iterator_next(state, &it);) {
+    state->camera.p = entity_get_render_p(state, it.e, alpha);
+  }
+  
+  state->frame_count++;
+  return alpha;
+}
+
+extern GAME_SIMULATE(game_simulate) {
+  State *state = (State *)memory.perm;
+  debug_state = (Debug_State *)memory.debug;
+  if (memory.is_reloaded) {
+    game_reload(state, memory, _platform);
+  }
+  assert(state->is_initialized);
+  
+  if (debug_state->gui.terminal.is_active) {
+    input = &state->empty_input;
+  }
+  
+  // NOTE(lvl5): the timers inside would pile up in the frame on screen
+  b32 was_paused = debug_state->pause;
+  debug_state->pause = true;
+  game_simulate_frame(state, screen_size, input, dt);
+  debug_state->pause = was_paused;
+  
+  arena_set_mark(&state->scratch, 0);
+}
+
+extern GAME_UPDATE(game_update) {
+  State *state = (State *)memory.perm;
+  debug_state = (Debug_State *)memory.debug;
+  Arena *arena = &state->arena;
+  
+  if (memory.is_reloaded) {
+    game_reload(state, memory, _platform);
+  }
+  
+  if (!state->is_initialized) {
+    arena_init(&state->arena, memory.perm + sizeof(State), 
+               memory.perm_size - sizeof(State));
+  }
+  
+  // NOTE(lvl5): a restored perm was initialized by another process, only
+  // the things outside of it have to be made again
+  if (!state->is_initialized || memory.is_restored) {
+    debug_init(memory.debug + sizeof(Debug_State));
+    debug_state->gui.selected_frame_index = -1;
+    
+    // NOTE(lvl5): when live reloading, the sound files can be overwritten
+    // with garbage since it's located in temp arena right now
+    state->test_sound = load_wav(&state->temp, const_string("sounds/durarara.wav"));
+    //sound_play(&state->sound_state, &state->test_sound, Sound_Type_MUSIC);
+    state->snd_bop = load_wav(&state->temp, const_string("sounds/bop.wav"));
+    
+    debug_add_arena(&state->arena, const_string("main"));
+    debug_add_arena(&state->temp, const_string("temp"));
+    debug_add_arena(&debug_state->arena, const_string("debug_main"));
+    debug_add_arena(&debug_state->gui.arena, const_string("debug_gui"));
+  }
+  
+  if (!state->is_initialized) {
+    push_arena_context(&state->arena);
+    
+    sound_init(&state->sound_state);
+    
+    state->frame_count = 0;
+    state->rand = make_random_sequence(2312323342);
+    
+    // NOTE(lvl5): font stuff
+    
+    //state->font = load_ttf(state, platform, const_string("Gugi-Regular.ttf"));
+    state->font = load_ttf(const_string("fonts/arial.ttf"));
+    
+    state->atlas = make_texture_atlas_from_folder(const_string("sprites"));
     
     Bitmap *bmp = &state->debug_atlas.bmp;
     *bmp = make_empty_bitmap(1, 1);
@@ -942,17 +2012,15 @@ extern GAME_UPDATE(game_update) {
     state->spr_wall = make_sprite(&state->atlas, 4, V2(0.5f, 0.5f));
     
     
-    gl.Enable(GL_BLEND);
-    gl.BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    
-    quad_renderer_init(&state->renderer, state);
-    add_entity_with_storage(state); // filler entity AND filler storage
+    entity_slot_map_init(&state->entities);
+    entity_tables_init(state);
+    state->misc_entity_storage_count = 1; // NOTE(lvl5): 0th storage is the null storage
     Entity *player = add_entity_player(state);
-    player->t.p = V3(0, 0, 0);
+    entity_set_p(state, player, V3(0, 0, 0));
     
     Entity *shooter = add_entity_shooter(state);
     //state->test_emitter = sound_emitter_add(&state->sound_state, &state->test_sound, v3_zero());
-    shooter->t.p = V3(4, 4, 0);
+    entity_set_p(state, shooter, V3(4, 4, 0));
     
     
     char *ascii_chunks[] = {
@@ -1006,7 +2074,7 @@ extern GAME_UPDATE(game_update) {
           }
         }
         
-        sb_push(state->tile_map.chunks, chunk);
+        tile_map_add_chunk(&state->tile_map, chunk);
       }
     }
     
@@ -1016,10 +2084,14 @@ extern GAME_UPDATE(game_update) {
     state->camera = zero_camera;
     
     
-    particle_emitter_init(&state->temp, &state->test_particle_emitter, state->spr_robot_eye, 1000000);
+    gpu_and_temp_init(state);
     
     pop_context();
     state->is_initialized = true;
+  } else if (memory.is_restored) {
+    push_arena_context(&state->arena);
+    gpu_and_temp_init(state);
+    pop_context();
   }
   
   if (memory.window_resized) {
@@ -1040,10 +2112,6 @@ extern GAME_UPDATE(game_update) {
   }
 #endif
   
-  state->camera.far = 10.0f;
-  state->camera.near = 0.0f;
-  state->camera.scale = V2(1.0f/PIXELS_PER_METER, 1.0f/PIXELS_PER_METER);
-  
   Mem_Size render_memory = arena_get_mark(&state->temp);
   Render_Group _group;
   Render_Group *group = &_group;
@@ -1054,13 +2122,6 @@ extern GAME_UPDATE(game_update) {
   global_group = group;
   render_font(group, &state->font);
   
-#if 1
-  //v2 half_screen_meters = v2_div_s(screen_size, PIXELS_PER_METER*2);
-  v2 mouse_meters = get_mouse_p_meters(input, screen_size);
-  v2 mouse_world = v2_add(state->camera.p.xy, mouse_meters);
-#endif
-  
-  
   DEBUG_SECTION_BEGIN(_draw_tiles);
   
 #if 0
@@ -1104,289 +2165,26 @@ extern GAME_UPDATE(game_update) {
   push_sprite(group, state->spr_robot_eye, transform_default());
 #endif
   
-  for (i32 entity_index = 1; entity_index < state->entity_count; entity_index++) {
-    Entity *e = get_entity(state, entity_index);
-    if (!e) continue;
-    
-    e->t.p = v3_add(e->t.p, v3_mul(e->d_p, dt));
-    v2 move_dir = {0};
-    
-    for (i32 skill_index = 0; 
-         skill_index < array_count(e->skills);
-         skill_index++) {
-      Skill *skill = e->skills + skill_index;
-      skill->cooldown.v -= dt;
-    }
-    
-    
-    switch (e->controller_type) {
-      case Controller_Type_PLAYER: {
-        //particle_emitter_emit(&state->test_particle_emitter, &state->rand, e->t.p, 10);
-        push_particle_emitter(group, &state->test_particle_emitter, dt);
-        
-        e->target_p = v2_to_v3(mouse_world, 0);
-        move_dir = v2_i(input->move_right.is_down - input->move_left.is_down,
-                        input->move_up.is_down - input->move_down.is_down);
-        
-        for (i32 skill_index = 0; 
-             skill_index < array_count(e->skills);
-             skill_index++) {
-          Skill *skill = e->skills + skill_index;
-          Button btn = input->skills[skill_index];
-          if (btn.went_up) {
-            b32 use_success = skill_use(state, e, skill);
-          }
-        }
-        
-        state->camera.p = e->t.p;
-      } break;
-      
-      case Controller_Type_AI_SHOOTER: {
-        switch (e->ai_state) {
-          state->test_emitter->p = e->t.p;
-          
-          case Ai_State_IDLE: {
-            f32 move_radius = 5.0f;
-            e->target_move_p = V3(random_range(&state->rand, -move_radius, move_radius),
-                                  random_range(&state->rand, -move_radius, move_radius),
-                                  0);
-            e->target_move_p = v3_add(e->t.p, e->target_move_p);
-            
-            if (e->ai_progress < 1) {
-              e->ai_progress += 0.02f;
-            } else {
-              e->ai_progress = 0;
-              e->ai_state = Ai_State_WALK_TO;
-            }
-          } break;
-          
-          case Ai_State_WALK_TO: {
-            Entity *target = query_closest_entity_flag(state, Entity_Flag_PLAYER, e->t.p);
-            if (target && v3_length(v3_sub(target->t.p, e->t.p)) < 5) {
-              e->ai_state = Ai_State_ALERT;
-              e->aggro_handle = get_entity_handle(target);
-              break;
-            }
-            
-            render_save(group);
-            render_color(group, V4(1, 0, 0, 1));
-            
-            push_rect(group, rect2_center_size(e->target_move_p.xy, V2(0.4f, 0.4f)));
-            render_restore(group);
-            
-            if (v3_length_sqr(v3_sub(e->t.p, e->target_move_p)) < 1.0f) {
-              e->ai_state = Ai_State_IDLE;
-            } else {
-              move_dir = v2_sub(e->target_move_p.xy, e->t.p.xy);
-            }
-          } break;
-          
-          case Ai_State_ALERT: {
-            Entity *target = query_entity_handle(state, e->aggro_handle);
-            if (target) {
-              if (v3_length(v3_sub(target->t.p, e->t.p)) > 8) {
-                e->aggro_handle = NULL_ENTITY_HANDLE;
-                e->ai_state = Ai_State_IDLE;
-                break;
-              }
-              
-              if (e->skills[0].cooldown.v <= 0) {
-                e->ai_state = Ai_State_TELE;
-                break;
-              }
-            } else {
-              e->ai_state = Ai_State_IDLE;
-            }
-          } break;
-          
-          case Ai_State_TELE: {
-            if (e->ai_progress < 1) {
-              e->ai_progress += 0.06f;
-              Entity *target = query_entity_handle(state, e->aggro_handle);
-              if (target) {
-                e->target_p = target->t.p;
-              }
-            } else {
-              e->ai_progress = 0;
-              e->ai_state = Ai_State_ATTACK;
-            }
-          } break;
-          
-          case Ai_State_ATTACK: {
-            Entity *target = query_entity_handle(state, e->aggro_handle);
-            if (target) {
-              e->target_p = target->t.p;
-              skill_use(state, e, e->skills + 0);
-              e->ai_state = Ai_State_ALERT;
-            }
-          } break;
-          
-          default: assert(false);
-        }
-      } break;
-    } 
-    
-    
-    f32 move_dir_len = v2_length(move_dir);
-    if (move_dir_len) {
-      move_dir = v2_div(move_dir, move_dir_len);
-    }
-    v2 d_d_p = v2_mul(move_dir, e->speed);
-    e->d_p = v3_add(e->d_p, v2_to_v3(d_d_p, 0));
-    e->d_p = v3_mul(e->d_p, e->friction);
-    
-    if (e->contact_damage) {
-      Entity **collide_list = query_entities_collide(state, e);
-      for (u32 i = 0; i < sb_count(collide_list); i++) {
-        Entity *other = collide_list[i];
-        
-        if (other->team != e->team &&
-            !flag_is_set(other->flags, Entity_Flag_PROJECTILE)) {
-          
-          b32 already_hit = false;
-          for (u32 pen_index = 0; pen_index < sb_count(e->penetrating_projectile.penetrated_entity_ids); pen_index++) {
-            i32 id = e->penetrating_projectile.penetrated_entity_ids[pen_index];
-            if (id == other->id) {
-              already_hit = true;
-            }
-          }
-          
-          if (already_hit) continue;
-          entity_take_damage(state, other, e->contact_damage);
-          
-          if (flag_is_set(e->flags, Entity_Flag_PROJECTILE)) {
-            sb_push(e->penetrating_projectile.penetrated_entity_ids, other->id);
-          }
-          
-#if 0
-          if (flag_is_set(e->flags, Entity_Flag_PROJECTILE)) {
-            remove_entity(state, e->index);
-          }
-#endif
-        }
-      }
-    }
-    
-    
-    rect2 bbox = get_bbox(e);
-    
-    // TODO(lvl5): this wont work with very big entities vs small walls
-    v2 corners[] = {
-      bbox.min,
-      V2(bbox.min.x, bbox.max.y),
-      bbox.max,
-      V2(bbox.max.x, bbox.min.y),
-    };
-    
-    for (i32 corner_index = 0;
-         corner_index < 4;
-         corner_index++) {
-      v2 corner = corners[corner_index];
-      
-      Tile_Position tile_p = get_tile_position(corner);
-      Tile *tile = get_tile(&state->tile_map, tile_p);
-      if (tile->terrain == Terrain_Kind_WALL) {
-        v2 world_p = V2((f32)(tile_p.chunk_x*CHUNK_SIZE + tile_p.tile_x)*TILE_SIZE_IN_METERS,
-                        (f32)(tile_p.chunk_y*CHUNK_SIZE + tile_p.tile_y)*TILE_SIZE_IN_METERS);
-        
-        Transform t = transform_default();
-        t.p = v2_to_v3(world_p, 0);
-        
-        render_save(group); 
-        render_color(group, V4(1, 0, 0, 0.5f));
-        
-        rect2 wall_bbox = rect2_center_size(world_p, V2(1, 1));
-        
-        render_restore(group);
-        Collision col = collide_aabb_aabb(bbox, wall_bbox);
-        if (col.success) {
-          e->t.p = v3_add(e->t.p, v2_to_v3(col.proj, 0));
-          if (col.proj.x) {
-            e->d_p.x = 0;
-          } else {
-            e->d_p.y = 0;
-          }
-          break;
-        }
-      }
-      
-    }
-    
-    if (e->lifetime.active) {
-      e->lifetime.time -= dt;
-      if (e->lifetime.time <= 0) {
-        remove_entity(state, e);
-      }
-    }
-    
-    
-    e->hp.v += e->hp.regen*dt;
-    e->mp.v += e->mp.regen*dt;
-    
-    if (e->hp.v > e->hp.max) {
-      e->hp.v = e->hp.max;
-    }
-    if (e->mp.v > e->mp.max) {
-      e->mp.v = e->mp.max;
-    }
-    
-    
-#if 1
-    if (flag_is_set(e->flags, Entity_Flag_ACTOR)) {
-      // NOTE(lvl5): draw hp and mp
-      String hp_string = tsprintf("HP: %.02f", e->hp.v);
-      f32 hp_string_width = font_get_text_width_meters(group->state.font, hp_string);
-      
-      String mp_string = tsprintf("MP: %.02f", e->mp.v);
-      
-      String ai_string = tsprintf("AI: %s %0.0f%%", 
-                                  Ai_State_to_string[e->ai_state],
-                                  e->ai_progress*100);
-      
-      render_save(group);
-      render_color(group, V4(0, 0, 0, 1));
-      render_translate(group, v3_add(e->t.p, V3(-hp_string_width*0.5f, 0.05f*PIXELS_PER_METER, 0)));
-      push_text(group, hp_string);
-      
-      render_translate(group, V3(0, -0.015f*PIXELS_PER_METER, 0));
-      push_text(group, mp_string);
-      
-      render_translate(group, V3(0, -0.015f*PIXELS_PER_METER, 0));
-      push_text(group, ai_string);
-      
-      render_restore(group);
-    }
-#endif
-    render_save(group);
-    render_transform(group, e->t);
-    
-    if (debug_get_var_i32(Debug_Var_Name_COLLIDERS)) {
-      switch (e->collider.type) {
-        case Collider_Type_BOX: {
-#if 0
-          render_rotate(group, 0.1f);
-          render_scale(group, V3(7, 7, 1));
-          push_rect(group, e->collider.box.rect);
-#endif
-          push_rect_outline(group, e->collider.box.rect, 0.04f);
-        } break;
-        case Collider_Type_CIRCLE: {
-          Circle_Collider coll = e->collider.circle;
-          push_circle_outline(group, coll.origin, coll.r, 0.04f);
-        } break;
-        default: assert(false);
-      }
-    }
-    render_restore(group);
+  f32 alpha = game_simulate_frame(state, screen_size, input, dt);
+  
+  for (Entity_Iterator it = iterate_entities_flag(state, Entity_Flag_PLAYER);
+       entity_iterator_next(state, &it);) {
+    //particle_emitter_burst(&state->test_particle_emitter, e->t.p.xy, 10);
+    push_particle_emitter(group, &state->test_particle_emitter);
   }
   
+  // NOTE(lvl5): off-screen particles are culled by the renderer, not here
+  particle_system_update(&state->particle_system, &state->temp, dt);
+  
+  entities_draw(state, group, alpha);
+  
   debug_log("particle count: %d", state->test_particle_emitter.particle_count);
   
   DEBUG_SECTION_BEGIN(_glClear);
   gl.ClearColor(0.2f, 0.2f, 0.2f, 1.0f);
   gl.Clear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
   DEBUG_SECTION_END(_glClear);
-  render_group_output(&state->temp, group, &state->renderer);
+  render_group_output(&state->temp, group, state->renderer);
   
   Sound_Buffer *buffer = platform.request_sound_buffer();
   sound_mix_playing_sounds(buffer, &state->sound_state, &state->temp, dt);
@@ -1403,6 +2201,4 @@ extern GAME_UPDATE(game_update) {
   
   arena_check_no_marks(&state->temp);
   arena_check_no_marks(&state->arena);
-  
-  state->frame_count++;
 }
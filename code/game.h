@@ -97,12 +97,6 @@ typedef enum {
   Rune_Type_HALF_COST,
 } Rune_Type;
 
-typedef struct {
-  f32 v;
-  f32 max;
-  f32 regen;
-} Resource;
-
 typedef struct {
   Skill_Type type;
   f32 damage;
@@ -111,13 +105,10 @@ typedef struct {
   Rune_Type runes[3];
   
   f32 mp_cost;
-  Resource cooldown;
+  f32 cooldown; // NOTE(lvl5): time left lives in Skill_Table.cooldowns
 } Skill;
 
-typedef struct {
-  b32 active;
-  f32 time;
-} Lifetime;
+#define SKILL_SLOT_COUNT 4
 
 typedef enum {
   Ai_State_NONE,
@@ -151,6 +142,8 @@ typedef enum {
   Entity_Flag_ACTOR = 1 << 2,
 } Entity_Flag;
 
+#define ENTITY_FLAG_COUNT 3
+
 typedef enum {
   Entity_Team_NONE,
   Entity_Team_PLAYER,
@@ -162,6 +155,8 @@ typedef struct {
   i32 index;
 } Entity_Handle;
 
+#define MAX_ENTITY_COUNT 10000
+
 #define NULL_ENTITY_HANDLE (Entity_Handle){.id = 0, .index = 0}
 #define NULL_SPRITE (Sprite){0}
 
@@ -187,36 +182,28 @@ typedef struct {
   i32 id;
   i32 index;
   
-  Transform t;
-  v3 d_p;
-  f32 d_angle;
-  f32 speed;
+  // NOTE(lvl5): indices into the component tables, 0 means no component
+  i32 motion_index;
+  i32 ai_index;
+  i32 skills_index;
+  i32 lifetime_index;
+  i32 resources_index;
+  
+  f32 angle;
+  v3 scale;
   
   Animation_Instance instance;
   Entity_Part *parts;
   i32 part_count;
   
   Collider collider;
-  Skill skills[4];
-  
-  Resource hp;
-  Resource mp;
-  
   f32 contact_damage;
   
   Controller_Type controller_type;
-  Ai_State ai_state;
-  f32 ai_progress;
-  Entity_Handle aggro_handle;
-  v3 target_p;
-  v3 target_move_p;
-  
-  f32 friction;
   u64 flags;
+  i32 flag_positions[ENTITY_FLAG_COUNT]; // NOTE(lvl5): position in each flag list
   Entity_Team team;
   
-  Lifetime lifetime;
-  
   i32 misc_storage_index;
   union {
     struct {
@@ -225,6 +212,56 @@ typedef struct {
   };
 } Entity;
 
+// NOTE(lvl5): component tables. The hot per-entity data lives here as SoA,
+// so every system can run as one tight loop over contiguous arrays.
+// Tables are dense, the 0th element is the null component, and 
+// entity_index maps each component back to the slot of its owner.
+
+typedef struct {
+  i32 entity_index[MAX_ENTITY_COUNT];
+  v3 p[MAX_ENTITY_COUNT];
+  v3 prev_p[MAX_ENTITY_COUNT]; // NOTE(lvl5): p at the start of the tick, for interpolation
+  v3 d_p[MAX_ENTITY_COUNT];
+  v2 move_dir[MAX_ENTITY_COUNT];
+  f32 speed[MAX_ENTITY_COUNT];
+  f32 friction[MAX_ENTITY_COUNT];
+  i32 count;
+} Motion_Table;
+
+typedef struct {
+  i32 entity_index[MAX_ENTITY_COUNT];
+  Ai_State state[MAX_ENTITY_COUNT];
+  f32 progress[MAX_ENTITY_COUNT];
+  Entity_Handle aggro_handle[MAX_ENTITY_COUNT];
+  v3 target_move_p[MAX_ENTITY_COUNT];
+  i32 count;
+} Ai_Table;
+
+typedef struct {
+  i32 entity_index[MAX_ENTITY_COUNT];
+  Skill skills[MAX_ENTITY_COUNT][SKILL_SLOT_COUNT];
+  f32 cooldowns[MAX_ENTITY_COUNT][SKILL_SLOT_COUNT];
+  v3 target_p[MAX_ENTITY_COUNT];
+  i32 count;
+} Skill_Table;
+
+typedef struct {
+  i32 entity_index[MAX_ENTITY_COUNT];
+  f32 time[MAX_ENTITY_COUNT];
+  i32 count;
+} Lifetime_Table;
+
+typedef struct {
+  i32 entity_index[MAX_ENTITY_COUNT];
+  f32 hp[MAX_ENTITY_COUNT];
+  f32 hp_max[MAX_ENTITY_COUNT];
+  f32 hp_regen[MAX_ENTITY_COUNT];
+  f32 mp[MAX_ENTITY_COUNT];
+  f32 mp_max[MAX_ENTITY_COUNT];
+  f32 mp_regen[MAX_ENTITY_COUNT];
+  i32 count;
+} Resource_Table;
+
 typedef enum {
   Terrain_Kind_NONE,
   Terrain_Kind_GRASS,
@@ -238,14 +275,25 @@ typedef struct {
 #define CHUNK_SIZE 8
 #define TILE_SIZE_IN_METERS 1
 
+// NOTE(lvl5): bit (tile_y*CHUNK_SIZE + tile_x) of the wall mask is set for
+// wall tiles, so every row of the chunk is one byte
+#define CHUNK_ROW_REPLICATE 0x0101010101010101ull
+
 typedef struct {
   Tile tiles[CHUNK_SIZE*CHUNK_SIZE];
+  u64 wall_mask;
   i32 x;
   i32 y;
 } Tile_Chunk;
 
+#define TILE_CHUNK_HASH_SIZE 4096 // must be a power of 2
+
 typedef struct {
   Tile_Chunk *chunks;
+  
+  // NOTE(lvl5): open addressing with linear probing, 
+  // stores chunk index + 1, 0 is an empty slot
+  i32 chunk_hash[TILE_CHUNK_HASH_SIZE];
 } Tile_Map;
 
 typedef struct {
@@ -256,15 +304,143 @@ typedef struct {
 } Tile_Position;
 
 
-#define MAX_ENTITY_COUNT 10000
+// NOTE(lvl5): entity ids pack the slot generation above the slot index,
+// so an id alone is enough to find and validate an entity
+#define ENTITY_INDEX_BITS 14
+#define ENTITY_INDEX_MASK ((1 << ENTITY_INDEX_BITS) - 1)
+#define ENTITY_GENERATION_MASK ((1 << (31 - ENTITY_INDEX_BITS)) - 1)
+
+typedef struct {
+  Entity slots[MAX_ENTITY_COUNT]; // 0th slot is the null entity
+  u32 generations[MAX_ENTITY_COUNT];
+  i32 slot_count;
+  
+  i32 free_list[MAX_ENTITY_COUNT];
+  i32 free_count;
+  
+  // NOTE(lvl5): dense list of live slot indices
+  i32 live[MAX_ENTITY_COUNT];
+  i32 live_positions[MAX_ENTITY_COUNT];
+  i32 live_count;
+  
+  // NOTE(lvl5): removed slots are only recycled at the end of the frame,
+  // so nothing moves around while the entities are being updated
+  i32 dead[MAX_ENTITY_COUNT];
+  i32 dead_count;
+} Entity_Slot_Map;
+
+// NOTE(lvl5): dense list of slot indices of the live entities with a flag,
+// kept up to date by flag_set/flag_remove and remove_entity
+typedef struct {
+  i32 entities[MAX_ENTITY_COUNT];
+  i32 count;
+} Entity_Flag_List;
+
+typedef struct {
+  Entity_Flag_List *list;
+  i32 position;
+  Entity *e;
+} Entity_Iterator;
+
+typedef enum {
+  Entity_Command_Type_NONE,
+  Entity_Command_Type_SPAWN_FIREBALL,
+  Entity_Command_Type_DESPAWN,
+  Entity_Command_Type_DAMAGE,
+  Entity_Command_Type_TELEPORT,
+} Entity_Command_Type;
+
+typedef struct {
+  Entity_Command_Type type;
+  i32 entity_id; // NOTE(lvl5): target, or the caster for spawns
+  union {
+    struct {
+      v3 p;
+      v3 d_p;
+      f32 angle;
+      f32 damage;
+      Entity_Team team;
+    } spawn_fireball;
+    struct {
+      f32 amount;
+    } damage;
+    struct {
+      v3 p;
+    } teleport;
+  };
+} Entity_Command;
+
+// NOTE(lvl5): every writer (the main thread, or one batch of a job) gets
+// its own segment, so recording needs no locks. Segments are applied 
+// in index order, which keeps the result independent of thread timing.
+// A batch records at most one command per entity in its range, so its
+// segment can't fill up as long as a batch fits in it. The main thread's
+// segment 0 has no such bound, when it's full more blocks get chained on
+// from the frame arena. Everything is still applied in one pass at the
+// end of the tick.
+#define ENTITY_COMMAND_SEGMENT_COUNT 16
+#define ENTITY_COMMAND_SEGMENT_SIZE 1024
+
+typedef struct Entity_Command_Segment Entity_Command_Segment;
+struct Entity_Command_Segment {
+  Entity_Command commands[ENTITY_COMMAND_SEGMENT_SIZE];
+  i32 count;
+  
+  // NOTE(lvl5): segment 0 only, null for the batches. The chain is
+  // dropped when the segment is applied
+  Arena *overflow_arena;
+  Entity_Command_Segment *next;
+  Entity_Command_Segment *tail;
+};
+
+typedef struct {
+  Entity_Command_Segment segments[ENTITY_COMMAND_SEGMENT_COUNT];
+} Entity_Command_Buffer;
+
+// NOTE(lvl5): uniform grid for broadphase entity queries.
+// cells are hashed into a fixed bucket table, so the world doesn't need bounds
+#define ENTITY_GRID_CELL_SIZE 2.0f
+#define ENTITY_GRID_BUCKET_COUNT 4096 // must be a power of 2
+#define ENTITY_GRID_MAX_NODES (MAX_ENTITY_COUNT*8)
+
+// NOTE(lvl5): the grid is built at the start of the frame, entities can move
+// this far before they have to be re-bucketed
+#define ENTITY_GRID_QUERY_MARGIN 0.5f
+
+typedef struct {
+  i32 entity_index;
+  i32 cell_x;
+  i32 cell_y;
+  i32 next; // 0 terminates the bucket chain
+} Entity_Grid_Node;
+
+typedef struct {
+  i32 buckets[ENTITY_GRID_BUCKET_COUNT];
+  Entity_Grid_Node nodes[ENTITY_GRID_MAX_NODES]; // 0th node is reserved
+  i32 node_count;
+  
+  u32 query_stamps[MAX_ENTITY_COUNT];
+  u32 query_stamp;
+} Entity_Grid;
+
+// NOTE(lvl5): the tick rate the gameplay constants were tuned at
+#define SIM_REFERENCE_RATE 60.0f
+// NOTE(lvl5): after a long stall drop the backlog instead of spiraling
+#define SIM_MAX_TICKS_PER_FRAME 8
 
 typedef struct {
   Particle_Emitter test_particle_emitter;
+  Particle_System particle_system;
   
-  i32 unique_entity_id;
   Tile_Map tile_map;
   
   Input empty_input;
+  
+  // NOTE(lvl5): the simulation runs at a fixed tick rate, button edges
+  // are latched until a tick gets to see them
+  Input tick_input;
+  f32 tick_accumulator;
+  u32 tick_count;
   Sound test_sound;
   Sound snd_bop;
   Sound_Emitter *test_emitter;
@@ -275,11 +451,16 @@ typedef struct {
   Arena scratch;
   Arena temp;
   
-  Entity entities[MAX_ENTITY_COUNT];
-  i32 entity_count;
+  Entity_Slot_Map entities;
+  Motion_Table motion;
+  Ai_Table ai;
+  Skill_Table skills;
+  Lifetime_Table lifetimes;
+  Resource_Table resources;
+  Entity_Flag_List flag_lists[ENTITY_FLAG_COUNT];
+  Entity_Command_Buffer entity_commands;
   
-  i32 entities_free_list[MAX_ENTITY_COUNT];
-  i32 entities_free_count;
+  Entity_Grid entity_grid;
   
   Misc_Entity_Storage misc_entity_storages[MAX_ENTITY_COUNT/10];
   i32 misc_entity_storage_count;
@@ -289,7 +470,10 @@ typedef struct {
   
   GLuint shader_basic;
   Texture_Atlas atlas;
-  Quad_Renderer renderer;
+  // NOTE(lvl5): gl names, fences and the ring head don't belong to the
+  // simulation, so the renderer lives at the start of temp. Restoring perm
+  // would leave it with stale fences and leak textures
+  Quad_Renderer *renderer;
   
   Font font;
   Texture_Atlas debug_atlas;
@@ -0,0 +1,1525 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <math.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define LVL5_DEBUG
+#include "lvl5_math.h"
+#include "lvl5_types.h"
+#include "lvl5_stretchy_buffer.h"
+
+#include "platform.h"
+
+// NOTE(lvl5): LINUX_HEADLESS builds without X11, EGL and ALSA. gl calls go
+// to a counting null implementation and sound goes nowhere, so it runs on
+// ci and perf machines that have no gpu
+#if !LINUX_HEADLESS
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/keysym.h>
+#include <X11/XKBlib.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <alsa/asoundlib.h>
+#endif
+
+#define TARGET_FPS 60
+#define MAX_FRAME_DT 0.25f
+#include "lvl5_context.h"
+
+#include "font.h"
+#include "debug.h"
+#include "replay.h"
+#include "benchmark.h"
+#include "snapshot.h"
+#include "rewind.h"
+
+#define LINUX_MAX_THREAD_COUNT 64
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+
+typedef struct {
+  i32 buffer_sample_count;
+  i32 samples_per_second;
+  i32 channel_count;
+#if LINUX_HEADLESS
+  void *pcm; // NOTE(lvl5): always null, samples are dropped
+#else
+  snd_pcm_t *pcm; // NOTE(lvl5): null means there's no device, samples are dropped
+#endif
+} linux_Sound;
+
+typedef struct {
+  b32 window_resized;
+  f32 dt;
+  volatile b32 running;
+  b32 headless;
+  linux_Sound sound;
+  Sound_Buffer game_sound_buffer;
+  i32 frame_limit; // NOTE(lvl5): 0 runs until closed
+  char *record_path;
+  char *replay_path; // NOTE(lvl5): plays the file back as fast as possible and reports timings
+  char *perm_image_path;
+  v2 window_size;
+
+  // NOTE(lvl5): F3 goes back a second. Only with --rewind, and not while
+  // recording or playing a replay
+  b32 rewind_enabled;
+  Rewind rewind;
+
+  Snapshot_Tracker dirty_pages;
+
+#if !LINUX_HEADLESS
+  Display *display;
+  Window window;
+  Atom wm_delete_window;
+
+  EGLDisplay egl_display;
+  EGLSurface egl_surface;
+  EGLContext egl_context;
+#endif
+} linux_State;
+
+linux_State state;
+
+
+f64 linux_get_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  f64 result = (f64)ts.tv_sec + (f64)ts.tv_nsec*1e-9;
+  return result;
+}
+
+PLATFORM_GET_TIME(linux_platform_get_time) {
+  f64 result = linux_get_time();
+  return result;
+}
+
+u64 linux_get_last_write_time(String file_name) {
+  u64 result = 0;
+  struct stat st;
+  if (stat(to_c_string(file_name), &st) == 0) {
+    result = (u64)st.st_mtim.tv_sec*1000000000ull + (u64)st.st_mtim.tv_nsec;
+  }
+  return result;
+}
+
+b32 linux_file_exists(String file_name) {
+  b32 result = access(to_c_string(file_name), F_OK) == 0;
+  return result;
+}
+
+// NOTE(lvl5): pread can return early, keep going until everything is read
+b32 linux_pread_all(int fd, void *dst, Mem_Size size, Mem_Size offset) {
+  byte *at = (byte *)dst;
+  while (size) {
+    ssize_t bytes_read = pread(fd, at, size, (off_t)offset);
+    if (bytes_read < 0 && errno == EINTR) continue;
+    if (bytes_read <= 0) return false;
+    at += bytes_read;
+    offset += bytes_read;
+    size -= bytes_read;
+  }
+  return true;
+}
+
+b32 linux_copy_file(char *src, char *dst) {
+  b32 result = false;
+  int in = open(src, O_RDONLY);
+  if (in >= 0) {
+    struct stat st;
+    fstat(in, &st);
+    int out = open(dst, O_WRONLY|O_CREAT|O_TRUNC, 0755);
+    if (out >= 0) {
+      byte *buffer = (byte *)malloc(st.st_size);
+      if (linux_pread_all(in, buffer, st.st_size, 0)) {
+        result = write(out, buffer, st.st_size) == st.st_size;
+      }
+      free(buffer);
+      close(out);
+    }
+    close(in);
+  }
+  return result;
+}
+
+
+// NOTE(lvl5): soft-dirty tracking. /proc/self/pagemap has a u64 per page
+// with bit 55 set if the page was written since the last "4" to
+// /proc/self/clear_refs. That clears the bits of the whole process, so the
+// save point and rewind go through a Snapshot_Tracker
+#define LINUX_PAGEMAP_SOFT_DIRTY (1ull << 55)
+
+b32 linux_clear_soft_dirty() {
+  b32 result = false;
+  int fd = open("/proc/self/clear_refs", O_WRONLY);
+  if (fd >= 0) {
+    result = write(fd, "4", 1) == 1;
+    close(fd);
+  }
+  return result;
+}
+
+b32 linux_page_is_soft_dirty(int pagemap, byte *page) {
+  u64 entry = 0;
+  Mem_Size offset = (Mem_Size)page/SNAPSHOT_PAGE_SIZE*sizeof(u64);
+  b32 result = linux_pread_all(pagemap, &entry, sizeof(entry), offset) &&
+    (entry & LINUX_PAGEMAP_SOFT_DIRTY);
+  return result;
+}
+
+SNAPSHOT_GET_DIRTY_PAGES(linux_get_dirty_pages) {
+  // NOTE(lvl5): kernels without CONFIG_MEM_SOFT_DIRTY read back zeros, which
+  // would look like nothing ever changed. Check once that a write shows up
+  static int pagemap = -1;
+  static b32 checked = false;
+  if (!checked) {
+    checked = true;
+    int fd = open("/proc/self/pagemap", O_RDONLY);
+    byte *test_page = (byte *)mmap(0, SNAPSHOT_PAGE_SIZE, PROT_READ|PROT_WRITE,
+                                   MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (fd >= 0 && test_page != MAP_FAILED && linux_clear_soft_dirty()) {
+      *(volatile byte *)test_page = 1;
+      if (linux_page_is_soft_dirty(fd, test_page)) {
+        pagemap = fd;
+      }
+    }
+    if (pagemap < 0 && fd >= 0) {
+      close(fd);
+    }
+    if (test_page != MAP_FAILED) {
+      munmap(test_page, SNAPSHOT_PAGE_SIZE);
+    }
+  }
+
+  i64 result = -1;
+  if (pagemap >= 0) {
+    result = 0;
+    u64 entries[512];
+    u64 page_total = size/SNAPSHOT_PAGE_SIZE;
+    Mem_Size first_offset = (Mem_Size)memory/SNAPSHOT_PAGE_SIZE*sizeof(u64);
+
+    for (u64 page_index = 0; page_index < page_total;) {
+      u64 batch_count = page_total - page_index;
+      if (batch_count > array_count(entries)) batch_count = array_count(entries);
+      if (!linux_pread_all(pagemap, entries, batch_count*sizeof(u64),
+                           first_offset + page_index*sizeof(u64))) {
+        result = -1;
+        break;
+      }
+      for (u64 entry_index = 0; entry_index < batch_count; entry_index++) {
+        if (entries[entry_index] & LINUX_PAGEMAP_SOFT_DIRTY) {
+          assert((u64)result < page_capacity);
+          pages[result++] = memory + (page_index + entry_index)*SNAPSHOT_PAGE_SIZE;
+        }
+      }
+      page_index += batch_count;
+    }
+
+    if (!linux_clear_soft_dirty()) {
+      result = -1;
+    }
+  }
+  return result;
+}
+
+typedef enum {
+  linux_Dirty_User_SAVE_POINT,
+  linux_Dirty_User_REWIND,
+} linux_Dirty_User;
+
+SNAPSHOT_GET_DIRTY_PAGES(linux_get_save_point_dirty_pages) {
+  i64 result = snapshot_tracker_take(&state.dirty_pages, linux_Dirty_User_SAVE_POINT,
+                                     memory, size, pages, page_capacity);
+  return result;
+}
+
+SNAPSHOT_GET_DIRTY_PAGES(linux_get_rewind_dirty_pages) {
+  i64 result = snapshot_tracker_take(&state.dirty_pages, linux_Dirty_User_REWIND,
+                                     memory, size, pages, page_capacity);
+  return result;
+}
+
+
+// NOTE(lvl5): perm image. A page of header, then perm, which is mapped
+// shared at the fixed base so writing to perm is writing to the file.
+// Saving is an msync, and a run that finds a matching image skips
+// game init. Any rebuild of game.so can change State, so the image only
+// matches the build that wrote it
+#define LINUX_PERM_IMAGE_MAGIC 0x4d524550 // "PERM"
+#define LINUX_PERM_IMAGE_OFFSET 4096
+
+typedef struct {
+  u32 magic;
+  b32 is_valid; // NOTE(lvl5): set once the first frame has initialized perm
+  u64 perm_size;
+  u64 game_lib_write_time;
+} linux_Perm_Image_Header;
+
+// NOTE(lvl5): returns the image fd, or -1 and perm stays anonymous memory
+int linux_map_perm_image(char *path, byte *perm, Mem_Size perm_size,
+                         u64 game_lib_write_time, b32 *is_restored) {
+  *is_restored = false;
+  int fd = open(path, O_RDWR|O_CREAT, 0644);
+  if (fd < 0) return -1;
+
+  linux_Perm_Image_Header header = {0};
+  struct stat st;
+  b32 matches = fstat(fd, &st) == 0 &&
+    (Mem_Size)st.st_size == LINUX_PERM_IMAGE_OFFSET + perm_size &&
+    linux_pread_all(fd, &header, sizeof(header), 0) &&
+    header.magic == LINUX_PERM_IMAGE_MAGIC &&
+    header.is_valid &&
+    header.perm_size == perm_size &&
+    header.game_lib_write_time == game_lib_write_time;
+
+  b32 success = true;
+  if (!matches) {
+    // NOTE(lvl5): truncating to 0 first zeroes the perm part
+    zero_memory_slow(&header, sizeof(header));
+    header.magic = LINUX_PERM_IMAGE_MAGIC;
+    header.perm_size = perm_size;
+    header.game_lib_write_time = game_lib_write_time;
+    success = ftruncate(fd, 0) == 0 &&
+      ftruncate(fd, LINUX_PERM_IMAGE_OFFSET + perm_size) == 0 &&
+      pwrite(fd, &header, sizeof(header), 0) == sizeof(header);
+  }
+
+  if (success) {
+    byte *mapped = (byte *)mmap(perm, perm_size, PROT_READ|PROT_WRITE,
+                                MAP_SHARED|MAP_FIXED, fd, LINUX_PERM_IMAGE_OFFSET);
+    if (mapped == perm) {
+      *is_restored = matches;
+    } else {
+      success = false;
+    }
+  }
+
+  if (!success) {
+    fprintf(stderr, "can't use %s as the perm image\n", path);
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+void linux_perm_image_write_header(int fd, b32 is_valid, u64 game_lib_write_time,
+                                   Mem_Size perm_size) {
+  linux_Perm_Image_Header header = {0};
+  header.magic = LINUX_PERM_IMAGE_MAGIC;
+  header.is_valid = is_valid;
+  header.perm_size = perm_size;
+  header.game_lib_write_time = game_lib_write_time;
+  pwrite(fd, &header, sizeof(header), 0);
+}
+
+
+typedef struct {
+  int fd;
+  Mem_Size size;
+  b32 no_errors;
+} linux_File;
+
+PLATFORM_OPEN_FILE(linux_open_file) {
+  int fd = open(to_c_string(file_name), O_RDONLY);
+
+  linux_File *result = (linux_File *)malloc(sizeof(linux_File));
+  result->fd = -1;
+  result->size = 0;
+  result->no_errors = false;
+
+  if (fd >= 0) {
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+      result->fd = fd;
+      result->size = st.st_size;
+      result->no_errors = true;
+    } else {
+      close(fd);
+    }
+  }
+
+  return (File_Handle)result;
+}
+
+PLATFORM_FILE_ERROR(linux_file_error) {
+  ((linux_File *)file)->no_errors = false;
+}
+
+PLATFORM_FILE_HAS_NO_ERRORS(linux_file_has_no_errors) {
+  b32 result = ((linux_File *)file)->no_errors;
+  return result;
+}
+
+PLATFORM_READ_FILE(linux_read_file) {
+  if (linux_file_has_no_errors(file)) {
+    b32 success = linux_pread_all(((linux_File *)file)->fd, dst, size, offset);
+    assert(success);
+  }
+}
+
+PLATFORM_CLOSE_FILE(linux_close_file) {
+  if (((linux_File *)file)->fd >= 0) {
+    close(((linux_File *)file)->fd);
+  }
+  free(file);
+}
+
+
+String linux_get_build_dir() {
+  String full_path;
+  full_path.data = (char *)scratch_alloc(sizeof(char)*PATH_MAX);
+  ssize_t length = readlink("/proc/self/exe", full_path.data, PATH_MAX);
+  assert(length > 0);
+  full_path.count = (u32)length;
+
+  u32 last_slash_index = find_last_index(full_path, const_string("/"));
+  String result = substring(full_path, 0, last_slash_index + 1);
+
+  return result;
+}
+
+String linux_get_work_dir() {
+  String result = const_string("../data/");
+  return result;
+}
+
+PLATFORM_READ_ENTIRE_FILE(linux_read_entire_file) {
+  String full_name = concat(linux_get_work_dir(), file_name);
+  int file = open(to_c_string(full_name), O_RDONLY);
+  assert(file >= 0);
+
+  struct stat st;
+  fstat(file, &st);
+  u64 file_size = st.st_size;
+
+  byte *buffer = (byte *)malloc(file_size);
+  b32 success = linux_pread_all(file, buffer, file_size, 0);
+  assert(success);
+
+  close(file);
+
+  Buffer result;
+  result.data = buffer;
+  result.size = file_size;
+
+  return result;
+}
+
+File_List linux_get_files_in_folder(String str) {
+  File_List result = {0};
+
+  // TODO(lvl5): this needs to be freed at some point
+  result.files = sb_new(String, 16);
+
+  String dir_name = concat(linux_get_work_dir(), str);
+  DIR *dir = opendir(to_c_string(dir_name));
+
+  if (dir) {
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+      if (entry->d_type == DT_DIR) continue;
+
+      char *src = entry->d_name;
+      i32 name_length = c_string_length(src);
+      char *dst = (char *)malloc(name_length);
+      copy_memory_slow(dst, src, name_length);
+
+      sb_push(result.files, make_string(dst, name_length));
+      result.count++;
+    }
+    closedir(dir);
+  }
+
+  return result;
+}
+
+
+ALLOCATOR(system_allocator) {
+  byte *result = null;
+  switch (type) {
+    case Alloc_Op_ALLOC: {
+      result = (byte *)malloc(size);
+    } break;
+
+    case Alloc_Op_FREE: {
+      free(old_ptr);
+    } break;
+
+    case Alloc_Op_REALLOC: {
+      result = realloc(old_ptr, size);
+    } break;
+
+    invalid_default_case;
+  }
+  return result;
+}
+
+
+// NOTE(lvl5): sound
+
+Sound_Buffer *linux_request_sound_buffer() {
+  linux_Sound *sound = &state.sound;
+  Sound_Buffer *game_sound_buffer = &state.game_sound_buffer;
+
+  i32 samples_per_frame = sound->samples_per_second/TARGET_FPS;
+  i32 count = samples_per_frame;
+
+#if !LINUX_HEADLESS
+  if (sound->pcm) {
+    snd_pcm_sframes_t avail = snd_pcm_avail_update(sound->pcm);
+    if (avail < 0) {
+      snd_pcm_recover(sound->pcm, (int)avail, 1);
+      avail = snd_pcm_avail_update(sound->pcm);
+      if (avail < 0) avail = 0;
+    }
+
+    // NOTE(lvl5): keep a frame of audio plus a frame of safety queued up
+    i32 queued = sound->buffer_sample_count - (i32)avail;
+    count = samples_per_frame*2 - queued;
+    if (count < 0) count = 0;
+    if (count > avail) count = (i32)avail;
+  }
+#endif
+
+  // NOTE(lvl5): the mixer works in blocks of 8 samples.
+  // ALSA can't take back queued samples, so nothing is ever overwritten
+  game_sound_buffer->count = count & ~7;
+  game_sound_buffer->overwrite_count = 0;
+
+  return game_sound_buffer;
+}
+
+void linux_fill_audio_buffer(linux_Sound *sound, Sound_Buffer *src_buffer) {
+#if !LINUX_HEADLESS
+  if (!sound->pcm) return;
+
+  snd_pcm_sframes_t written = snd_pcm_writei(sound->pcm, src_buffer->samples,
+                                             src_buffer->count);
+  if (written < 0) {
+    snd_pcm_recover(sound->pcm, (int)written, 1);
+  }
+#endif
+}
+
+void linux_init_sound(linux_Sound *sound, b32 use_device) {
+  sound->samples_per_second = SAMPLES_PER_SECOND;
+  sound->channel_count = 2;
+  sound->buffer_sample_count = align_pow_2(sound->samples_per_second, 16);
+  sound->pcm = null;
+
+#if !LINUX_HEADLESS
+  if (use_device) {
+    snd_pcm_t *pcm;
+    if (snd_pcm_open(&pcm, "default", SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK) == 0) {
+      int params_set = snd_pcm_set_params(pcm, SND_PCM_FORMAT_S16_LE,
+                                          SND_PCM_ACCESS_RW_INTERLEAVED,
+                                          sound->channel_count,
+                                          sound->samples_per_second,
+                                          1, 100000);
+      if (params_set == 0) {
+        snd_pcm_uframes_t buffer_size, period_size;
+        snd_pcm_get_params(pcm, &buffer_size, &period_size);
+        sound->buffer_sample_count = (i32)buffer_size;
+        sound->pcm = pcm;
+      } else {
+        snd_pcm_close(pcm);
+      }
+    }
+
+    if (!sound->pcm) {
+      fprintf(stderr, "could not open an audio device, sound is disabled\n");
+    }
+  }
+#endif
+
+  i32 sample_capacity = align_pow_2(sound->samples_per_second, 16);
+  if (sound->buffer_sample_count > sample_capacity) {
+    sample_capacity = sound->buffer_sample_count;
+  }
+
+  Sound_Buffer game_sound_buffer = {0};
+  game_sound_buffer.samples = (i16 *)calloc(sample_capacity*sound->channel_count, sizeof(i16));
+  state.game_sound_buffer = game_sound_buffer;
+}
+
+
+// NOTE(lvl5): opengl
+
+#define LINUX_GL_FUNCS(X) \
+X(Enable) X(BlendFunc) X(Viewport) X(ClearColor) X(Clear) \
+X(GenBuffers) X(GenVertexArrays) X(GenTextures) \
+X(DeleteBuffers) X(DeleteVertexArrays) X(DeleteTextures) \
+X(BindVertexArray) X(BindBuffer) X(BindTexture) \
+X(VertexAttribPointer) X(EnableVertexAttribArray) X(VertexAttribDivisor) \
+X(BufferData) X(MapBufferRange) X(UnmapBuffer) \
+X(TexParameteri) X(TexImage2D) X(UseProgram) X(DrawArraysInstanced) \
+X(CreateShader) X(ShaderSource) X(CompileShader) X(GetShaderiv) X(GetShaderInfoLog) \
+X(CreateProgram) X(AttachShader) X(LinkProgram) X(GetProgramiv) X(GetProgramInfoLog) \
+X(DeleteShader) X(GetUniformLocation) X(UniformMatrix4fv)
+
+// NOTE(lvl5): newer than what we ask for, the renderer checks for null.
+// null gl leaves them out, so it takes the path every driver has
+#define LINUX_GL_OPTIONAL_FUNCS(X) \
+X(BufferStorage) X(FenceSync) X(ClientWaitSync) X(DeleteSync)
+
+#if LINUX_HEADLESS
+
+// NOTE(lvl5): null gl. Nothing reaches a driver, every call is only counted,
+// so a run can report what the renderer would have submitted. Calls that
+// hand out names or report a status answer like a happy driver would
+typedef enum {
+#define LINUX_NULL_GL_CALL(name) linux_Gl_Call_##name,
+  LINUX_GL_FUNCS(LINUX_NULL_GL_CALL)
+#undef LINUX_NULL_GL_CALL
+  linux_Gl_Call_COUNT,
+} linux_Gl_Call;
+
+char *linux_gl_call_names[] = {
+#define LINUX_NULL_GL_CALL_NAME(name) "gl" #name,
+  LINUX_GL_FUNCS(LINUX_NULL_GL_CALL_NAME)
+#undef LINUX_NULL_GL_CALL_NAME
+};
+
+typedef struct {
+  u64 calls[linux_Gl_Call_COUNT];
+  u64 draw_count;
+  u64 instance_count;
+  u64 upload_bytes;
+  GLuint next_name;
+  void *map_memory;
+  u64 map_capacity;
+} linux_Null_Gl;
+
+linux_Null_Gl null_gl;
+
+// NOTE(lvl5): the plain no-ops have no prototype. The caller cleans up the
+// arguments on x64, so they are fine to call through any of the gl types
+#define LINUX_NULL_GL_NOOP(name) \
+  void linux_null_gl_##name() { null_gl.calls[linux_Gl_Call_##name]++; }
+
+LINUX_GL_FUNCS(LINUX_NULL_GL_NOOP)
+
+#undef LINUX_NULL_GL_NOOP
+
+void linux_null_gl_gen_names(GLsizei count, GLuint *names) {
+  for (GLsizei name_index = 0; name_index < count; name_index++) {
+    names[name_index] = ++null_gl.next_name;
+  }
+}
+
+void linux_null_gl_gen_buffers(GLsizei count, GLuint *names) {
+  null_gl.calls[linux_Gl_Call_GenBuffers]++;
+  linux_null_gl_gen_names(count, names);
+}
+
+void linux_null_gl_gen_vertex_arrays(GLsizei count, GLuint *names) {
+  null_gl.calls[linux_Gl_Call_GenVertexArrays]++;
+  linux_null_gl_gen_names(count, names);
+}
+
+void linux_null_gl_gen_textures(GLsizei count, GLuint *names) {
+  null_gl.calls[linux_Gl_Call_GenTextures]++;
+  linux_null_gl_gen_names(count, names);
+}
+
+GLuint linux_null_gl_create_shader(GLenum type) {
+  null_gl.calls[linux_Gl_Call_CreateShader]++;
+  GLuint result = ++null_gl.next_name;
+  return result;
+}
+
+GLuint linux_null_gl_create_program() {
+  null_gl.calls[linux_Gl_Call_CreateProgram]++;
+  GLuint result = ++null_gl.next_name;
+  return result;
+}
+
+void linux_null_gl_get_shaderiv(GLuint shader, GLenum name, GLint *params) {
+  null_gl.calls[linux_Gl_Call_GetShaderiv]++;
+  *params = name == GL_COMPILE_STATUS ? GL_TRUE : 0;
+}
+
+void linux_null_gl_get_programiv(GLuint program, GLenum name, GLint *params) {
+  null_gl.calls[linux_Gl_Call_GetProgramiv]++;
+  *params = name == GL_LINK_STATUS ? GL_TRUE : 0;
+}
+
+void linux_null_gl_get_info_log(GLuint object, GLsizei max_length,
+                                GLsizei *length, GLchar *log) {
+  if (length) *length = 0;
+  if (max_length > 0) log[0] = 0;
+}
+
+GLint linux_null_gl_get_uniform_location(GLuint program, const GLchar *name) {
+  null_gl.calls[linux_Gl_Call_GetUniformLocation]++;
+  return 0;
+}
+
+void linux_null_gl_buffer_data(GLenum target, GLsizeiptr size,
+                               const void *data, GLenum usage) {
+  null_gl.calls[linux_Gl_Call_BufferData]++;
+  // NOTE(lvl5): no data is only orphaning, nothing goes over
+  if (data) {
+    null_gl.upload_bytes += size;
+  }
+}
+
+// NOTE(lvl5): every mapping gets the same scratch memory, nobody reads it back
+void *linux_null_gl_map_buffer_range(GLenum target, GLintptr offset,
+                                     GLsizeiptr length, GLbitfield access) {
+  null_gl.calls[linux_Gl_Call_MapBufferRange]++;
+  null_gl.upload_bytes += length;
+  if ((u64)length > null_gl.map_capacity) {
+    free(null_gl.map_memory);
+    null_gl.map_memory = malloc(length);
+    null_gl.map_capacity = length;
+  }
+  return null_gl.map_memory;
+}
+
+GLboolean linux_null_gl_unmap_buffer(GLenum target) {
+  null_gl.calls[linux_Gl_Call_UnmapBuffer]++;
+  return GL_TRUE;
+}
+
+void linux_null_gl_tex_image_2d(GLenum target, GLint level, GLint internal_format,
+                                GLsizei width, GLsizei height, GLint border,
+                                GLenum format, GLenum type, const void *data) {
+  null_gl.calls[linux_Gl_Call_TexImage2D]++;
+  // NOTE(lvl5): everything we upload is rgba8
+  null_gl.upload_bytes += (u64)width*height*4;
+}
+
+void linux_null_gl_draw_arrays_instanced(GLenum mode, GLint first,
+                                         GLsizei count, GLsizei instance_count) {
+  null_gl.calls[linux_Gl_Call_DrawArraysInstanced]++;
+  null_gl.draw_count++;
+  null_gl.instance_count += instance_count;
+}
+
+gl_Funcs linux_load_null_gl_funcs() {
+  gl_Funcs result = {0};
+#define LINUX_LOAD_NULL_GL_FUNC(name) \
+  *(void **)&result.name = (void *)linux_null_gl_##name;
+
+  LINUX_GL_FUNCS(LINUX_LOAD_NULL_GL_FUNC)
+
+#undef LINUX_LOAD_NULL_GL_FUNC
+
+  *(void **)&result.GenBuffers = (void *)linux_null_gl_gen_buffers;
+  *(void **)&result.GenVertexArrays = (void *)linux_null_gl_gen_vertex_arrays;
+  *(void **)&result.GenTextures = (void *)linux_null_gl_gen_textures;
+  *(void **)&result.CreateShader = (void *)linux_null_gl_create_shader;
+  *(void **)&result.CreateProgram = (void *)linux_null_gl_create_program;
+  *(void **)&result.GetShaderiv = (void *)linux_null_gl_get_shaderiv;
+  *(void **)&result.GetProgramiv = (void *)linux_null_gl_get_programiv;
+  *(void **)&result.GetShaderInfoLog = (void *)linux_null_gl_get_info_log;
+  *(void **)&result.GetProgramInfoLog = (void *)linux_null_gl_get_info_log;
+  *(void **)&result.GetUniformLocation = (void *)linux_null_gl_get_uniform_location;
+  *(void **)&result.BufferData = (void *)linux_null_gl_buffer_data;
+  *(void **)&result.MapBufferRange = (void *)linux_null_gl_map_buffer_range;
+  *(void **)&result.UnmapBuffer = (void *)linux_null_gl_unmap_buffer;
+  *(void **)&result.TexImage2D = (void *)linux_null_gl_tex_image_2d;
+  *(void **)&result.DrawArraysInstanced = (void *)linux_null_gl_draw_arrays_instanced;
+  return result;
+}
+
+void linux_null_gl_report(i32 frame_count) {
+  if (frame_count < 1) frame_count = 1;
+  f64 frames = (f64)frame_count;
+
+  printf("gl per frame: %.1f draws, %.1f instances, %.1f KB uploaded\n",
+         null_gl.draw_count/frames, null_gl.instance_count/frames,
+         null_gl.upload_bytes/frames/1024.0);
+  for (i32 call_index = 0; call_index < linux_Gl_Call_COUNT; call_index++) {
+    u64 calls = null_gl.calls[call_index];
+    if (calls) {
+      printf("  %-26s %10llu (%.1f/frame)\n", linux_gl_call_names[call_index],
+             (unsigned long long)calls, calls/frames);
+    }
+  }
+}
+
+#else
+
+gl_Funcs linux_load_gl_funcs() {
+  gl_Funcs result = {0};
+#define LINUX_LOAD_GL_FUNC(name) \
+  *(void **)&result.name = (void *)eglGetProcAddress("gl" #name); \
+  assert(result.name);
+
+  LINUX_GL_FUNCS(LINUX_LOAD_GL_FUNC)
+
+#undef LINUX_LOAD_GL_FUNC
+#define LINUX_LOAD_OPTIONAL_GL_FUNC(name) \
+  *(void **)&result.name = (void *)eglGetProcAddress("gl" #name);
+
+  // NOTE(lvl5): egl hands out pointers for anything the driver knows,
+  // whether this context has it or not. They are all in 4.4
+  void (*get_integerv)(GLenum, GLint *) =
+    (void (*)(GLenum, GLint *))eglGetProcAddress("glGetIntegerv");
+  GLint major = 0;
+  GLint minor = 0;
+  get_integerv(0x821B, &major); // NOTE(lvl5): GL_MAJOR_VERSION
+  get_integerv(0x821C, &minor); // NOTE(lvl5): GL_MINOR_VERSION
+  if (major > 4 || (major == 4 && minor >= 4)) {
+    LINUX_GL_OPTIONAL_FUNCS(LINUX_LOAD_OPTIONAL_GL_FUNC)
+  }
+
+#undef LINUX_LOAD_OPTIONAL_GL_FUNC
+  return result;
+}
+
+void linux_init_opengl() {
+  EGLDisplay display = EGL_NO_DISPLAY;
+
+  if (state.headless) {
+    // NOTE(lvl5): surfaceless mesa works on machines without a display server
+    PFNEGLGETPLATFORMDISPLAYEXTPROC eglGetPlatformDisplayEXT =
+      (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (eglGetPlatformDisplayEXT) {
+      display = eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, null);
+    }
+    if (display == EGL_NO_DISPLAY) {
+      display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+  } else {
+    display = eglGetDisplay((EGLNativeDisplayType)state.display);
+  }
+  assert(display != EGL_NO_DISPLAY);
+
+  b32 initialized = eglInitialize(display, null, null);
+  assert(initialized);
+  eglBindAPI(EGL_OPENGL_API);
+
+  EGLint config_attribs[] = {
+    EGL_SURFACE_TYPE, state.headless ? EGL_PBUFFER_BIT : EGL_WINDOW_BIT,
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_RED_SIZE, 8,
+    EGL_GREEN_SIZE, 8,
+    EGL_BLUE_SIZE, 8,
+    EGL_ALPHA_SIZE, 8,
+    EGL_DEPTH_SIZE, 24,
+    EGL_SAMPLE_BUFFERS, state.headless ? 0 : 1,
+    EGL_SAMPLES, state.headless ? 0 : 4,
+    EGL_NONE,
+  };
+  EGLConfig config;
+  EGLint config_count = 0;
+  eglChooseConfig(display, config_attribs, &config, 1, &config_count);
+  assert(config_count > 0);
+
+  EGLint context_attribs[] = {
+    EGL_CONTEXT_MAJOR_VERSION, 3,
+    EGL_CONTEXT_MINOR_VERSION, 3,
+    EGL_NONE,
+  };
+  EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+  assert(context != EGL_NO_CONTEXT);
+
+  EGLSurface surface;
+  if (state.headless) {
+    EGLint pbuffer_attribs[] = {
+      EGL_WIDTH, (EGLint)state.window_size.x,
+      EGL_HEIGHT, (EGLint)state.window_size.y,
+      EGL_NONE,
+    };
+    surface = eglCreatePbufferSurface(display, config, pbuffer_attribs);
+  } else {
+    surface = eglCreateWindowSurface(display, config, (EGLNativeWindowType)state.window, null);
+  }
+  assert(surface != EGL_NO_SURFACE);
+
+  b32 made_current = eglMakeCurrent(display, surface, surface, context);
+  assert(made_current);
+  eglSwapInterval(display, state.headless ? 0 : 1);
+
+  state.egl_display = display;
+  state.egl_surface = surface;
+  state.egl_context = context;
+}
+
+void linux_init_window() {
+  Display *display = XOpenDisplay(null);
+  assert(display);
+
+  i32 screen = DefaultScreen(display);
+  Window window = XCreateSimpleWindow(display, RootWindow(display, screen),
+                                      0, 0,
+                                      (u32)state.window_size.x, (u32)state.window_size.y,
+                                      0, BlackPixel(display, screen),
+                                      BlackPixel(display, screen));
+  XSelectInput(display, window,
+               KeyPressMask|KeyReleaseMask|ButtonPressMask|ButtonReleaseMask|
+               StructureNotifyMask);
+  XStoreName(display, window, "skill_game");
+
+  state.wm_delete_window = XInternAtom(display, "WM_DELETE_WINDOW", false);
+  XSetWMProtocols(display, window, &state.wm_delete_window, 1);
+  XMapWindow(display, window);
+
+  // NOTE(lvl5): held keys only repeat the press, like on windows
+  XkbSetDetectableAutoRepeat(display, true, null);
+
+  state.display = display;
+  state.window = window;
+}
+
+
+// NOTE(lvl5): input
+
+void linux_handle_button(Button *button, b32 is_down) {
+  if (is_down) {
+    button->pressed = true;
+  }
+  if (button->is_down && !is_down) {
+    button->went_up = true;
+  } else if (!button->is_down && is_down) {
+    button->went_down = true;
+  }
+  button->is_down = (bool)is_down;
+}
+
+// NOTE(lvl5): Input.keys is indexed with windows virtual key codes
+u32 linux_keysym_to_key_code(KeySym sym) {
+  u32 result = 0;
+  if (sym >= XK_a && sym <= XK_z) {
+    result = (u32)(sym - XK_a) + 'A';
+  } else if (sym >= XK_A && sym <= XK_Z) {
+    result = (u32)sym;
+  } else if (sym >= XK_0 && sym <= XK_9) {
+    result = (u32)sym;
+  } else {
+    switch (sym) {
+      case XK_BackSpace: result = 0x08; break;
+      case XK_Tab: result = 0x09; break;
+      case XK_Return: result = 0x0D; break;
+      case XK_Shift_L: case XK_Shift_R: result = 0x10; break;
+      case XK_Control_L: case XK_Control_R: result = 0x11; break;
+      case XK_Escape: result = 0x1B; break;
+      case XK_space: result = 0x20; break;
+      case XK_Left: result = 0x25; break;
+      case XK_Up: result = 0x26; break;
+      case XK_Right: result = 0x27; break;
+      case XK_Down: result = 0x28; break;
+      case XK_Delete: result = 0x2E; break;
+      case XK_grave: result = 0xC0; break;
+      case XK_F3: result = 0x72; break;
+      case XK_F5: result = 0x74; break;
+      case XK_F9: result = 0x78; break;
+    }
+  }
+  return result;
+}
+
+void linux_handle_key(Input *input, XKeyEvent *event, b32 is_down) {
+  char text[8];
+  KeySym sym;
+  i32 text_length = XLookupString(event, text, sizeof(text), &sym, null);
+  if (is_down && text_length == 1) {
+    input->char_code = text[0];
+  }
+
+  u32 key_code = linux_keysym_to_key_code(sym);
+  if (key_code && key_code < array_count(input->keys)) {
+    linux_handle_button(&input->keys[key_code], is_down);
+  }
+
+  switch (key_code) {
+    case 0x25: case 'A': linux_handle_button(&input->move_left, is_down); break;
+    case 0x27: case 'D': linux_handle_button(&input->move_right, is_down); break;
+    case 0x26: case 'W': linux_handle_button(&input->move_up, is_down); break;
+    case 0x28: case 'S': linux_handle_button(&input->move_down, is_down); break;
+    case 'Q': linux_handle_button(&input->skills[2], is_down); break;
+    case 'E': linux_handle_button(&input->skills[3], is_down); break;
+    case 0x20: linux_handle_button(&input->start, is_down); break;
+  }
+}
+
+void linux_process_events(Input *input) {
+  while (XPending(state.display)) {
+    XEvent event;
+    XNextEvent(state.display, &event);
+
+    switch (event.type) {
+      case KeyPress:
+      case KeyRelease: {
+        linux_handle_key(input, &event.xkey, event.type == KeyPress);
+      } break;
+
+      case ButtonPress:
+      case ButtonRelease: {
+        b32 is_down = event.type == ButtonPress;
+        switch (event.xbutton.button) {
+          case Button1: {
+            linux_handle_button(&input->mouse.left, is_down);
+            linux_handle_button(&input->skills[0], is_down);
+          } break;
+          case Button3: {
+            linux_handle_button(&input->mouse.right, is_down);
+            linux_handle_button(&input->skills[1], is_down);
+          } break;
+          case Button4: {
+            if (is_down) input->mouse.scroll = 1;
+          } break;
+          case Button5: {
+            if (is_down) input->mouse.scroll = -1;
+          } break;
+        }
+      } break;
+
+      case ConfigureNotify: {
+        v2 size = V2((f32)event.xconfigure.width, (f32)event.xconfigure.height);
+        if (size.x != state.window_size.x || size.y != state.window_size.y) {
+          state.window_size = size;
+          state.window_resized = true;
+        }
+      } break;
+
+      case ClientMessage: {
+        if ((Atom)event.xclient.data.l[0] == state.wm_delete_window) {
+          state.running = false;
+        }
+      } break;
+    }
+  }
+
+  Window root, child;
+  i32 root_x, root_y, x, y;
+  u32 mask;
+  XQueryPointer(state.display, state.window, &root, &child, &root_x, &root_y, &x, &y, &mask);
+  input->mouse.p.x = (f32)x;
+  input->mouse.p.y = state.window_size.y - (f32)y;
+}
+
+#endif
+
+
+// NOTE(lvl5): work queue
+
+typedef struct {
+  volatile i32 write_cursor;
+  volatile i32 read_cursor;
+  volatile i32 completion_goal;
+  volatile i32 completion_count;
+  Work_Queue_Entry entries[256];
+  volatile i32 semaphore;
+} linux_Work_Queue;
+
+typedef struct {
+  linux_Work_Queue *queue;
+  i32 thread_index;
+} linux_Thread_Info;
+
+void linux_semaphore_post(volatile i32 *semaphore) {
+  __sync_fetch_and_add(semaphore, 1);
+  syscall(SYS_futex, semaphore, FUTEX_WAKE_PRIVATE, 1, null, null, 0);
+}
+
+void linux_semaphore_wait(volatile i32 *semaphore) {
+  while (true) {
+    i32 value = *semaphore;
+    if (value > 0) {
+      if (__sync_bool_compare_and_swap(semaphore, value, value - 1)) {
+        break;
+      }
+    } else {
+      // NOTE(lvl5): sleeps only if nothing was posted in the meantime
+      syscall(SYS_futex, semaphore, FUTEX_WAIT_PRIVATE, 0, null, null, 0);
+    }
+  }
+}
+
+PLATFORM_ADD_WORK_QUEUE_ENTRY(linux_add_queue_entry) {
+  linux_Work_Queue *queue = (linux_Work_Queue *)queue_ptr;
+
+  Work_Queue_Entry *entry = queue->entries + queue->write_cursor;
+  entry->fn = fn;
+  entry->data = data;
+  queue->completion_goal++;
+
+  __sync_synchronize();
+  i32 new_write_cursor = (queue->write_cursor + 1) % array_count(queue->entries);
+  assert(new_write_cursor != queue->read_cursor);
+  queue->write_cursor = new_write_cursor;
+  linux_semaphore_post(&queue->semaphore);
+}
+
+b32 linux_do_next_queue_entry(linux_Work_Queue *queue) {
+  b32 result = true;
+
+  i32 original_read_cursor = queue->read_cursor;
+  i32 new_read_cursor = (original_read_cursor + 1) %
+    array_count(queue->entries);
+
+  if (original_read_cursor != queue->write_cursor) {
+    i32 index = __sync_val_compare_and_swap(&queue->read_cursor,
+                                            original_read_cursor,
+                                            new_read_cursor);
+    if (index == original_read_cursor) {
+      Work_Queue_Entry *entry = queue->entries + index;
+      entry->fn(entry->data);
+      __sync_fetch_and_add(&queue->completion_count, 1);
+    }
+  } else {
+    result = false;
+  }
+
+  return result;
+}
+
+PLATFORM_COMPLETE_ALL_WORK(linux_complete_all_work) {
+  linux_Work_Queue *queue = (linux_Work_Queue *)queue_ptr;
+
+  while (queue->completion_count != queue->completion_goal) {
+    linux_do_next_queue_entry(queue);
+  }
+
+  queue->completion_goal = 0;
+  queue->completion_count = 0;
+}
+
+void *linux_thread_proc(void *data) {
+  linux_Thread_Info *info = (linux_Thread_Info *)data;
+  linux_Work_Queue *queue = info->queue;
+
+  while (true) {
+    b32 should_try_again = linux_do_next_queue_entry(queue);
+    if (!should_try_again) {
+      linux_semaphore_wait(&queue->semaphore);
+    }
+  }
+
+  return 0;
+}
+
+
+void linux_handle_signal(int signal) {
+  state.running = false;
+}
+
+int main(int argc, char **argv) {
+  {
+    // NOTE(lvl5): context stuff
+    Global_Context_Info info = {0};
+    Context default_ctx = {0};
+    default_ctx.allocator = system_allocator;
+    Arena scratch;
+    Mem_Size scratch_size = megabytes(64);
+    arena_init(&scratch, malloc(scratch_size), scratch_size);
+    default_ctx.scratch = scratch;
+
+    global_context_info = &info;
+    push_context(default_ctx);
+  }
+
+  for (i32 arg_index = 1; arg_index < argc; arg_index++) {
+    if (c_string_compare(argv[arg_index], "--headless")) {
+      state.headless = true;
+    } else if (c_string_compare(argv[arg_index], "--frames") &&
+               arg_index + 1 < argc) {
+      state.frame_limit = atoi(argv[++arg_index]);
+    } else if (c_string_compare(argv[arg_index], "--record") &&
+               arg_index + 1 < argc) {
+      state.record_path = argv[++arg_index];
+    } else if (c_string_compare(argv[arg_index], "--replay") &&
+               arg_index + 1 < argc) {
+      state.replay_path = argv[++arg_index];
+    } else if (c_string_compare(argv[arg_index], "--perm-image") &&
+               arg_index + 1 < argc) {
+      state.perm_image_path = argv[++arg_index];
+    } else if (c_string_compare(argv[arg_index], "--rewind")) {
+      state.rewind_enabled = true;
+    }
+  }
+
+#if LINUX_HEADLESS
+  state.headless = true;
+#endif
+  if (state.headless || state.record_path || state.replay_path) {
+    state.rewind_enabled = false;
+  }
+
+  signal(SIGINT, linux_handle_signal);
+  signal(SIGTERM, linux_handle_signal);
+
+  static linux_Work_Queue high_queue = {0};
+  static linux_Thread_Info thread_infos[LINUX_MAX_THREAD_COUNT];
+
+  // NOTE(lvl5): the main thread helps out in complete_all_work
+  i32 thread_count = (i32)sysconf(_SC_NPROCESSORS_ONLN) - 1;
+  if (thread_count < 1) thread_count = 1;
+  if (thread_count > LINUX_MAX_THREAD_COUNT) thread_count = LINUX_MAX_THREAD_COUNT;
+
+  for (i32 thread_index = 0; thread_index < thread_count; thread_index++) {
+    linux_Thread_Info *info = thread_infos + thread_index;
+    info->queue = &high_queue;
+    info->thread_index = thread_index;
+    pthread_t thread;
+    pthread_create(&thread, null, linux_thread_proc, info);
+    pthread_detach(thread);
+  }
+
+  state.window_size = V2(1280, 720);
+#if LINUX_HEADLESS
+  gl = linux_load_null_gl_funcs();
+#else
+  if (!state.headless) {
+    linux_init_window();
+  }
+  linux_init_opengl();
+  gl = linux_load_gl_funcs();
+#endif
+
+  linux_init_sound(&state.sound, !state.headless);
+
+  Memory game_memory = {0};
+  game_memory.global_context_info = global_context_info;
+  game_memory.perm_size = megabytes(64);
+  game_memory.temp_size = gigabytes(1);
+  game_memory.debug_size = megabytes(512);
+  Mem_Size total_size = game_memory.perm_size + game_memory.temp_size + game_memory.debug_size;
+
+  // NOTE(lvl5): same fixed base as on windows, so pointers in a saved
+  // perm block stay valid. Pages are committed on first touch
+  byte *total_memory = (byte *)mmap((void *)terabytes(2), total_size,
+                                    PROT_READ|PROT_WRITE,
+                                    MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE|MAP_FIXED_NOREPLACE,
+                                    -1, 0);
+  assert(total_memory == (byte *)terabytes(2));
+
+  game_memory.perm = total_memory;
+  game_memory.temp = game_memory.perm + game_memory.perm_size;
+  game_memory.debug = game_memory.temp + game_memory.temp_size;
+
+  // NOTE(lvl5): replays bring their own perm
+  b32 perm_is_restored = false;
+  int perm_image_fd = -1;
+  if (state.perm_image_path && !state.replay_path && !state.record_path) {
+    String lib_path = concat(linux_get_build_dir(), const_string("game.so"));
+    perm_image_fd = linux_map_perm_image(state.perm_image_path, game_memory.perm,
+                                         game_memory.perm_size,
+                                         linux_get_last_write_time(lib_path),
+                                         &perm_is_restored);
+  }
+
+  Input game_input = {0};
+
+  state.running = true;
+  state.dt = 1.0f/TARGET_FPS;
+
+  static Replay_Writer replay_writer;
+  static Replay_Reader replay_reader;
+  static Benchmark benchmark;
+
+  // NOTE(lvl5): F5 saves perm, F9 goes back to it. Both only copy the pages
+  // written in between
+  static Snapshot save_point;
+  b32 has_save_point = false;
+  if (!state.headless) {
+    byte *save_point_copy = (byte *)mmap(0, game_memory.perm_size, PROT_READ|PROT_WRITE,
+                                         MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,
+                                         -1, 0);
+    assert(save_point_copy != MAP_FAILED);
+    if (perm_is_restored) {
+      memcpy(save_point_copy, game_memory.perm, game_memory.perm_size);
+    }
+    snapshot_tracker_init(&state.dirty_pages, game_memory.perm, game_memory.perm_size,
+                          linux_get_dirty_pages);
+    snapshot_init(&save_point, game_memory.perm, game_memory.perm_size,
+                  save_point_copy, linux_get_save_point_dirty_pages);
+    if (state.rewind_enabled) {
+      rewind_init(&state.rewind, game_memory.perm, game_memory.perm_size,
+                  linux_get_rewind_dirty_pages);
+    }
+  }
+
+  if (state.replay_path) {
+    if (!replay_read_begin(&replay_reader, state.replay_path,
+                           game_memory.perm, game_memory.perm_size)) {
+      fprintf(stderr, "can't play %s: missing file or recorded by a different build\n",
+              state.replay_path);
+      return 1;
+    }
+    if (state.window_size.x != replay_reader.header.window_size.x ||
+        state.window_size.y != replay_reader.header.window_size.y) {
+      state.window_size = replay_reader.header.window_size;
+      state.window_resized = true;
+    }
+    benchmark_begin(&benchmark, linux_get_time());
+  } else if (state.record_path) {
+    if (!replay_write_begin(&replay_writer, state.record_path,
+                            game_memory.perm, game_memory.perm_size,
+                            state.window_size)) {
+      fprintf(stderr, "can't record to %s\n", state.record_path);
+      return 1;
+    }
+  }
+
+  f64 last_time = linux_get_time();
+
+  Platform platform;
+  platform.get_time = linux_platform_get_time;
+  platform.request_sound_buffer = linux_request_sound_buffer;
+  platform.read_entire_file = linux_read_entire_file;
+  platform.gl = gl;
+  platform.get_files_in_folder = linux_get_files_in_folder;
+  platform.open_file = linux_open_file;
+  platform.file_error = linux_file_error;
+  platform.file_has_no_errors = linux_file_has_no_errors;
+  platform.read_file = linux_read_file;
+  platform.close_file = linux_close_file;
+  platform.add_work_queue_entry = linux_add_queue_entry;
+  platform.complete_all_work = linux_complete_all_work;
+  platform.high_queue = (Work_Queue)&high_queue;
+  platform.low_queue = 0;
+
+  void *game_lib = 0;
+  Game_Update *game_update = 0;
+  Game_Simulate *game_simulate = 0;
+  u64 last_game_lib_write_time = 0;
+
+  i32 frame_count = 0;
+  f64 update_time_total = 0;
+  f64 update_time_max = 0;
+  f64 run_start_time = linux_get_time();
+
+  while (state.running) {
+    scratch_reset();
+
+    {
+      String build_dir = linux_get_build_dir();
+      String lock_path = concat(build_dir, const_string("lock.tmp"));
+      b32 lock_file_exists = linux_file_exists(lock_path);
+      String lib_path = concat(build_dir, const_string("game.so"));
+
+      u64 current_write_time = linux_get_last_write_time(lib_path);
+      if (!lock_file_exists &&
+          current_write_time &&
+          last_game_lib_write_time != current_write_time) {
+        if (game_lib) {
+          dlclose(game_lib);
+        }
+
+        // NOTE(lvl5): dlopen hands back the cached handle for a path
+        // it has seen, so load a copy
+        String copy_lib_path = concat(build_dir, const_string("game_temp.so"));
+        char *src = to_c_string(lib_path);
+        char *dst = to_c_string(copy_lib_path);
+        b32 copy_success = linux_copy_file(src, dst);
+        assert(copy_success);
+
+        game_lib = dlopen(dst, RTLD_NOW|RTLD_LOCAL);
+        if (!game_lib) {
+          fprintf(stderr, "%s\n", dlerror());
+        }
+        assert(game_lib);
+        game_update = (Game_Update *)dlsym(game_lib, "game_update");
+        assert(game_update);
+        game_simulate = (Game_Simulate *)dlsym(game_lib, "game_simulate");
+        assert(game_simulate);
+
+        last_game_lib_write_time = current_write_time;
+        game_memory.is_reloaded = true;
+
+        if (perm_image_fd >= 0 && frame_count) {
+          // NOTE(lvl5): perm now belongs to the new build
+          linux_perm_image_write_header(perm_image_fd, true, current_write_time,
+                                        game_memory.perm_size);
+        }
+      } else {
+        game_memory.is_reloaded = false;
+      }
+    }
+
+    for (u32 button_index = 0;
+         button_index < array_count(game_input.buttons);
+         button_index++) {
+      Button *b = game_input.buttons + button_index;
+      b->went_down = false;
+      b->went_up = false;
+      b->pressed = false;
+    }
+
+    for (u32 button_index = 0;
+         button_index < array_count(game_input.keys);
+         button_index++) {
+      Button *b = game_input.keys + button_index;
+      b->went_down = false;
+      b->went_up = false;
+      b->pressed = false;
+    }
+
+    game_input.mouse.left.went_up = false;
+    game_input.mouse.left.went_down = false;
+    game_input.mouse.right.went_up = false;
+    game_input.mouse.right.went_down = false;
+
+    game_input.char_code = 0;
+    game_input.mouse.scroll = 0;
+
+#if !LINUX_HEADLESS
+    if (!state.headless) {
+      linux_process_events(&game_input);
+
+      b32 save = game_input.keys[0x74].went_down;
+      b32 load = game_input.keys[0x78].went_down && has_save_point;
+      if (save || load) {
+        f64 snapshot_start_time = linux_get_time();
+        if (save) {
+          snapshot_save(&save_point);
+          has_save_point = true;
+        } else {
+          snapshot_restore(&save_point);
+          // NOTE(lvl5): the recorded inputs don't lead here
+          if (state.rewind_enabled) {
+            rewind_clear(&state.rewind);
+          }
+        }
+        printf("%s save point: %llu pages in %.3fms\n", save ? "saved" : "loaded",
+               (unsigned long long)save_point.last_page_count,
+               (linux_get_time() - snapshot_start_time)*1000.0);
+      }
+    }
+#endif
+
+    if (state.replay_path) {
+      if (!replay_read_frame(&replay_reader, &game_input, &state.dt)) {
+        break;
+      }
+    } else if (state.record_path) {
+      replay_write_frame(&replay_writer, &game_input, state.dt);
+    }
+
+    if (state.window_resized) {
+      game_memory.window_resized = true;
+      state.window_resized = false;
+    } else {
+      game_memory.window_resized = false;
+    }
+
+    game_memory.is_restored = perm_is_restored && frame_count == 0;
+
+    // NOTE(lvl5): rewind starts after the frame that initialized the game,
+    // game_simulate can't do that part
+    if (state.rewind_enabled && frame_count) {
+      Rewind *r = &state.rewind;
+      if (game_input.keys[0x72].went_down && r->keyframe_count) {
+        u64 target_frame = r->frame > TARGET_FPS ? r->frame - TARGET_FPS : 0;
+        rewind_seek(r, game_memory.perm, target_frame);
+
+        Memory resim_memory = game_memory;
+        resim_memory.window_resized = false;
+        Input resim_input;
+        f32 resim_dt;
+        while (rewind_next_resim_frame(r, &resim_input, &resim_dt)) {
+          game_simulate(state.window_size, resim_memory, &resim_input, resim_dt, platform);
+          resim_memory.is_reloaded = false;
+        }
+        game_memory.is_reloaded = resim_memory.is_reloaded;
+      }
+      rewind_record_frame(r, game_memory.perm, &game_input, state.dt);
+    }
+
+    f64 update_start_time = linux_get_time();
+    game_update(state.window_size, game_memory, &game_input, state.dt, platform);
+    f64 update_time = linux_get_time() - update_start_time;
+    update_time_total += update_time;
+    if (update_time > update_time_max) {
+      update_time_max = update_time;
+    }
+
+    if (perm_image_fd >= 0 && frame_count == 0 && !perm_is_restored) {
+      linux_perm_image_write_header(perm_image_fd, true, last_game_lib_write_time,
+                                    game_memory.perm_size);
+      msync(game_memory.perm, game_memory.perm_size, MS_ASYNC);
+    }
+
+    if (state.replay_path) {
+      benchmark_add_frame(&benchmark, update_time, (Debug_State *)game_memory.debug);
+    }
+
+    if (state.game_sound_buffer.count) {
+      linux_fill_audio_buffer(&state.sound, &state.game_sound_buffer);
+    }
+
+    f64 current_time = linux_get_time();
+
+    if (state.headless) {
+      // NOTE(lvl5): headless runs as fast as it can, one sim tick per frame
+      state.dt = 1.0f/TARGET_FPS;
+    } else {
+      state.dt = (f32)(current_time - last_time);
+      if (state.dt > MAX_FRAME_DT) {
+        state.dt = MAX_FRAME_DT;
+      }
+    }
+    last_time = current_time;
+
+#if !LINUX_HEADLESS
+    eglSwapBuffers(state.egl_display, state.egl_surface);
+#endif
+
+    frame_count++;
+    if (state.frame_limit && frame_count >= state.frame_limit) {
+      state.running = false;
+    }
+  }
+
+  if (perm_image_fd >= 0) {
+    msync(game_memory.perm, game_memory.perm_size, MS_SYNC);
+    close(perm_image_fd);
+  }
+
+  if (state.replay_path) {
+    replay_read_end(&replay_reader);
+    if (replay_reader.header.frame_count == REPLAY_FRAME_COUNT_UNKNOWN) {
+      printf("%s: %d frames, the recording wasn't closed\n",
+             state.replay_path, frame_count);
+    } else {
+      printf("%s: %d of %u frames\n", state.replay_path,
+             frame_count, replay_reader.header.frame_count);
+    }
+    benchmark_report(&benchmark, linux_get_time());
+  } else if (state.record_path) {
+    replay_write_end(&replay_writer);
+    printf("%s: %u frames\n", state.record_path, replay_writer.frame_count);
+  }
+
+  if (state.headless && frame_count) {
+    f64 run_time = linux_get_time() - run_start_time;
+    printf("%d frames in %.3fs, %.1f frames/s\n",
+           frame_count, run_time, frame_count/run_time);
+    printf("game_update: %.3fms avg, %.3fms max\n",
+           update_time_total/frame_count*1000.0, update_time_max*1000.0);
+#if LINUX_HEADLESS
+    linux_null_gl_report(frame_count);
+#endif
+  }
+
+#if !LINUX_HEADLESS
+  if (state.display) {
+    XCloseDisplay(state.display);
+  }
+#endif
+
+  return 0;
+}
@@ -0,0 +1,338 @@
+#include "particle.h"
+
+#if PARTICLE_LANES == 8
+typedef __m256 Particle_Lane;
+typedef __m256i Particle_Lane_U32;
+#define lane_load _mm256_load_ps
+#define lane_store _mm256_store_ps
+#define lane_storeu _mm256_storeu_ps
+#define lane_set1 _mm256_set1_ps
+#define lane_add _mm256_add_ps
+#define lane_sub _mm256_sub_ps
+#define lane_mul _mm256_mul_ps
+#define lane_u32_load(p) _mm256_loadu_si256((__m256i *)(p))
+#define lane_u32_store(p, x) _mm256_storeu_si256((__m256i *)(p), x)
+#define lane_u32_set1 _mm256_set1_epi32
+#define lane_u32_xor _mm256_xor_si256
+#define lane_u32_or _mm256_or_si256
+#define lane_u32_shl _mm256_slli_epi32
+#define lane_u32_shr _mm256_srli_epi32
+#define lane_u32_as_f32 _mm256_castsi256_ps
+#else
+typedef __m128 Particle_Lane;
+typedef __m128i Particle_Lane_U32;
+#define lane_load _mm_load_ps
+#define lane_store _mm_store_ps
+#define lane_storeu _mm_storeu_ps
+#define lane_set1 _mm_set_ps1
+#define lane_add _mm_add_ps
+#define lane_sub _mm_sub_ps
+#define lane_mul _mm_mul_ps
+#define lane_u32_load(p) _mm_loadu_si128((__m128i *)(p))
+#define lane_u32_store(p, x) _mm_storeu_si128((__m128i *)(p), x)
+#define lane_u32_set1 _mm_set1_epi32
+#define lane_u32_xor _mm_xor_si128
+#define lane_u32_or _mm_or_si128
+#define lane_u32_shl _mm_slli_epi32
+#define lane_u32_shr _mm_srli_epi32
+#define lane_u32_as_f32 _mm_castsi128_ps
+#endif
+
+Particle_Emitter_Desc particle_emitter_desc_default() {
+  Particle_Emitter_Desc d = {0};
+  d.p_min = V2(-0.1f, -0.1f);
+  d.p_max = V2(0.1f, 0.1f);
+  d.scale_min = V2(0.1f, 0.1f);
+  d.scale_max = V2(0.5f, 0.5f);
+  d.angle_min = -PI;
+  d.angle_max = PI;
+  d.color_min = V4(0, 0, 0, 1);
+  d.color_max = V4(1, 1, 1, 1);
+
+  d.d_p_min = V2(-4, -4);
+  d.d_p_max = V2(4, 4);
+  d.d_scale_min = V2(-0.1f, -0.1f);
+  d.d_scale_max = V2(-0.02f, -0.02f);
+  d.d_angle_min = 1.0f;
+  d.d_angle_max = -1.0f;
+  d.d_color_min = V4(0.01f, 0.01f, 0.01f, -0.1f);
+  d.d_color_max = V4(-0.01f, -0.01f, -0.01f, -0.5f);
+
+  d.lifetime_min = 2.0f;
+  d.lifetime_max = 5.0f;
+  return d;
+}
+
+// NOTE(lvl5): emitters with the same seed emit the same particles
+void particle_emitter_seed(Particle_Emitter *emitter, u32 seed) {
+  for (i32 lane = 0; lane < PARTICLE_LANES; lane++) {
+    u32 x = seed*2654435761u + lane*40503u + 1;
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    // NOTE(lvl5): xorshift gets stuck on 0
+    emitter->rand_lanes[lane] = x ? x : 1;
+  }
+}
+
+void particle_emitter_init(Arena *arena, Particle_Emitter *emitter, Sprite sprite, i32 capacity) {
+  Particle_Emitter zero_emitter = {0};
+  *emitter = zero_emitter;
+  assert(sizeof(emitter->streams) == PARTICLE_STREAM_COUNT*sizeof(f32 *));
+
+  // NOTE(lvl5): emission writes whole lanes from wherever the count is,
+  // so there's a lane of slack past the capacity on top of the alignment
+  u64 align = PARTICLE_LANES*sizeof(f32);
+  i32 padded_capacity = (capacity + PARTICLE_LANES - 1)/PARTICLE_LANES*PARTICLE_LANES;
+  for (i32 stream_index = 0; stream_index < PARTICLE_STREAM_COUNT; stream_index++) {
+    f32 *stream = arena_push_array(arena, f32, padded_capacity + 2*PARTICLE_LANES);
+    emitter->streams[stream_index] = (f32 *)(((u64)stream + align - 1) & ~(align - 1));
+  }
+  emitter->particle_capacity = capacity;
+  emitter->sprite = sprite;
+  emitter->desc = particle_emitter_desc_default();
+  particle_emitter_seed(emitter, 0);
+}
+
+// NOTE(lvl5): uniform in [0, 1) for every lane
+Particle_Lane particle_lane_random(Particle_Lane_U32 *state) {
+  Particle_Lane_U32 x = *state;
+  x = lane_u32_xor(x, lane_u32_shl(x, 13));
+  x = lane_u32_xor(x, lane_u32_shr(x, 17));
+  x = lane_u32_xor(x, lane_u32_shl(x, 5));
+  *state = x;
+  // NOTE(lvl5): the top 23 bits as the mantissa of a float in [1, 2)
+  Particle_Lane one_to_two = lane_u32_as_f32(lane_u32_or(lane_u32_shr(x, 9),
+                                                         lane_u32_set1(0x3f800000)));
+  Particle_Lane result = lane_sub(one_to_two, lane_set1(1.0f));
+  return result;
+}
+
+// NOTE(lvl5): count new particles at p, PARTICLE_LANES per iteration.
+// What doesn't fit in the emitter is dropped
+void particle_emitter_burst(Particle_Emitter *emitter, v2 p, i32 count) {
+  i32 free_count = emitter->particle_capacity - emitter->particle_count;
+  if (count > free_count) {
+    count = free_count;
+  }
+
+  Particle_Emitter_Desc *d = &emitter->desc;
+  Particle_Lane_U32 rand = lane_u32_load(emitter->rand_lanes);
+  i32 begin = emitter->particle_count;
+  i32 end = begin + count;
+
+#define PARTICLE_EMIT(x, min, max) \
+  lane_storeu(emitter->x + i, lane_add(lane_set1(min), \
+                                       lane_mul(lane_set1((max) - (min)), \
+                                                particle_lane_random(&rand))));
+
+  for (i32 i = begin; i < end; i += PARTICLE_LANES) {
+    PARTICLE_EMIT(p_x, p.x + d->p_min.x, p.x + d->p_max.x);
+    PARTICLE_EMIT(p_y, p.y + d->p_min.y, p.y + d->p_max.y);
+    PARTICLE_EMIT(scale_x, d->scale_min.x, d->scale_max.x);
+    PARTICLE_EMIT(scale_y, d->scale_min.y, d->scale_max.y);
+    PARTICLE_EMIT(angle, d->angle_min, d->angle_max);
+    PARTICLE_EMIT(r, d->color_min.r, d->color_max.r);
+    PARTICLE_EMIT(g, d->color_min.g, d->color_max.g);
+    PARTICLE_EMIT(b, d->color_min.b, d->color_max.b);
+    PARTICLE_EMIT(a, d->color_min.a, d->color_max.a);
+
+    PARTICLE_EMIT(d_p_x, d->d_p_min.x, d->d_p_max.x);
+    PARTICLE_EMIT(d_p_y, d->d_p_min.y, d->d_p_max.y);
+    PARTICLE_EMIT(d_scale_x, d->d_scale_min.x, d->d_scale_max.x);
+    PARTICLE_EMIT(d_scale_y, d->d_scale_min.y, d->d_scale_max.y);
+    PARTICLE_EMIT(d_angle, d->d_angle_min, d->d_angle_max);
+    PARTICLE_EMIT(d_r, d->d_color_min.r, d->d_color_max.r);
+    PARTICLE_EMIT(d_g, d->d_color_min.g, d->d_color_max.g);
+    PARTICLE_EMIT(d_b, d->d_color_min.b, d->d_color_max.b);
+    PARTICLE_EMIT(d_a, d->d_color_min.a, d->d_color_max.a);
+
+    PARTICLE_EMIT(lifetime, d->lifetime_min, d->lifetime_max);
+  }
+
+#undef PARTICLE_EMIT
+
+  lane_u32_store(emitter->rand_lanes, rand);
+  emitter->particle_count = end;
+}
+
+// NOTE(lvl5): begin has to be on a lane boundary, end gets rounded up
+// into the padding
+void particle_emitter_integrate(Particle_Emitter *emitter, i32 begin, i32 end, f32 dt) {
+  assert(begin % PARTICLE_LANES == 0);
+  Particle_Lane dt_lane = lane_set1(dt);
+
+#define PARTICLE_INTEGRATE(x, d_x) \
+  lane_store(emitter->x + i, lane_add(lane_load(emitter->x + i), \
+                                      lane_mul(lane_load(emitter->d_x + i), dt_lane)));
+
+  for (i32 i = begin; i < end; i += PARTICLE_LANES) {
+    PARTICLE_INTEGRATE(p_x, d_p_x);
+    PARTICLE_INTEGRATE(p_y, d_p_y);
+    PARTICLE_INTEGRATE(scale_x, d_scale_x);
+    PARTICLE_INTEGRATE(scale_y, d_scale_y);
+    PARTICLE_INTEGRATE(angle, d_angle);
+    PARTICLE_INTEGRATE(r, d_r);
+    PARTICLE_INTEGRATE(g, d_g);
+    PARTICLE_INTEGRATE(b, d_b);
+    PARTICLE_INTEGRATE(a, d_a);
+    lane_store(emitter->lifetime + i, lane_sub(lane_load(emitter->lifetime + i), dt_lane));
+  }
+
+#undef PARTICLE_INTEGRATE
+}
+
+// NOTE(lvl5): moves the live particles of [begin, end) to the front of
+// it, in order. Returns where they end
+i32 particle_emitter_compact(Particle_Emitter *emitter, i32 begin, i32 end) {
+  i32 write = begin;
+  for (i32 read = begin; read < end; read++) {
+    b32 is_alive = emitter->lifetime[read] > 0 && emitter->a[read] > 0 &&
+      emitter->scale_x[read] > 0 && emitter->scale_y[read] > 0;
+    if (is_alive) {
+      if (write != read) {
+        for (i32 stream_index = 0; stream_index < PARTICLE_STREAM_COUNT; stream_index++) {
+          f32 *stream = emitter->streams[stream_index];
+          stream[write] = stream[read];
+        }
+      }
+      write++;
+    }
+  }
+  return write;
+}
+
+// NOTE(lvl5): after the chunks are compacted, the particles that ended
+// up past the total move into the holes before it, taken from the back.
+// Only as many particles move as died, and the result only depends on
+// the chunks
+void particle_emitter_merge_chunks(Particle_Emitter *emitter, Particle_Chunk *chunks, i32 chunk_count) {
+  i32 total = 0;
+  for (i32 chunk_index = 0; chunk_index < chunk_count; chunk_index++) {
+    total += chunks[chunk_index].live_end - chunks[chunk_index].begin;
+  }
+
+  i32 src_chunk = chunk_count - 1;
+  i32 src = chunks[src_chunk].live_end;
+  for (i32 chunk_index = 0; chunk_index < chunk_count; chunk_index++) {
+    Particle_Chunk *chunk = chunks + chunk_index;
+    if (chunk->begin >= total) break;
+
+    i32 hole_end = chunk->end < total ? chunk->end : total;
+    for (i32 hole = chunk->live_end; hole < hole_end; hole++) {
+      while (src == chunks[src_chunk].begin) {
+        src_chunk--;
+        src = chunks[src_chunk].live_end;
+      }
+      src--;
+      assert(src >= total);
+
+      for (i32 stream_index = 0; stream_index < PARTICLE_STREAM_COUNT; stream_index++) {
+        f32 *stream = emitter->streams[stream_index];
+        stream[hole] = stream[src];
+      }
+    }
+  }
+
+  emitter->particle_count = total;
+}
+
+
+void particle_system_init(Particle_System *system) {
+  zero_memory_slow(system, sizeof(Particle_System));
+}
+
+// NOTE(lvl5): every emitter gets its own random streams, by the order they're added
+void particle_system_add_emitter(Particle_System *system, Particle_Emitter *emitter) {
+  assert(system->emitter_count < array_count(system->emitters));
+  system->emitters[system->emitter_count++] = emitter;
+  particle_emitter_seed(emitter, system->emitter_count);
+}
+
+void particle_chunk_update(Particle_Chunk *chunk) {
+  particle_emitter_integrate(chunk->emitter, chunk->begin, chunk->end, chunk->dt);
+  chunk->live_end = particle_emitter_compact(chunk->emitter, chunk->begin, chunk->end);
+}
+
+// NOTE(lvl5): a run of consecutive chunks. The work queue only has so
+// many entries, so the chunks are spread over at most PARTICLE_MAX_JOBS
+typedef struct {
+  Particle_Chunk *chunks;
+  i32 chunk_count;
+} Particle_Job;
+
+#define PARTICLE_MAX_JOBS 64
+
+WORKER_FN(particle_job_update) {
+  Particle_Job *job = (Particle_Job *)data;
+  for (i32 chunk_index = 0; chunk_index < job->chunk_count; chunk_index++) {
+    particle_chunk_update(job->chunks + chunk_index);
+  }
+}
+
+// NOTE(lvl5): the split only depends on the particle counts, and a chunk
+// only reads and writes its own range, so the outcome doesn't depend on
+// which thread ran what
+void particle_system_update(Particle_System *system, Arena *arena, f32 dt) {
+  DEBUG_FUNCTION_BEGIN();
+
+  i32 chunk_count = 0;
+  i32 emitter_chunk_firsts[PARTICLE_SYSTEM_MAX_EMITTERS + 1];
+  for (i32 emitter_index = 0; emitter_index < system->emitter_count; emitter_index++) {
+    Particle_Emitter *emitter = system->emitters[emitter_index];
+    emitter_chunk_firsts[emitter_index] = chunk_count;
+    chunk_count += (emitter->particle_count + PARTICLE_CHUNK_SIZE - 1)/PARTICLE_CHUNK_SIZE;
+  }
+  emitter_chunk_firsts[system->emitter_count] = chunk_count;
+
+  Particle_Chunk *chunks = arena_push_array(arena, Particle_Chunk, chunk_count);
+  for (i32 emitter_index = 0; emitter_index < system->emitter_count; emitter_index++) {
+    Particle_Emitter *emitter = system->emitters[emitter_index];
+    Particle_Chunk *chunk = chunks + emitter_chunk_firsts[emitter_index];
+    for (i32 begin = 0; begin < emitter->particle_count; begin += PARTICLE_CHUNK_SIZE) {
+      chunk->emitter = emitter;
+      chunk->begin = begin;
+      chunk->end = begin + PARTICLE_CHUNK_SIZE < emitter->particle_count ?
+        begin + PARTICLE_CHUNK_SIZE : emitter->particle_count;
+      chunk->live_end = chunk->end;
+      chunk->dt = dt;
+      chunk++;
+    }
+  }
+
+  if (chunk_count == 1) {
+    particle_chunk_update(chunks);
+  } else if (chunk_count > 1) {
+    i32 job_size = (chunk_count + PARTICLE_MAX_JOBS - 1)/PARTICLE_MAX_JOBS;
+    Particle_Job jobs[PARTICLE_MAX_JOBS];
+    i32 job_count = 0;
+    for (i32 first = 0; first < chunk_count; first += job_size) {
+      Particle_Job *job = jobs + job_count++;
+      job->chunks = chunks + first;
+      job->chunk_count = first + job_size < chunk_count ? job_size : chunk_count - first;
+      platform.add_work_queue_entry(platform.high_queue, particle_job_update, job);
+    }
+    platform.complete_all_work(platform.high_queue);
+  }
+
+  for (i32 emitter_index = 0; emitter_index < system->emitter_count; emitter_index++) {
+    i32 first = emitter_chunk_firsts[emitter_index];
+    i32 count = emitter_chunk_firsts[emitter_index + 1] - first;
+    if (count) {
+      particle_emitter_merge_chunks(system->emitters[emitter_index], chunks + first, count);
+    }
+  }
+
+  // NOTE(lvl5): after the step, so new particles show up where they were emitted
+  for (i32 emitter_index = 0; emitter_index < system->emitter_count; emitter_index++) {
+    Particle_Emitter *emitter = system->emitters[emitter_index];
+    emitter->rate_remainder += emitter->desc.rate*dt;
+    i32 count = (i32)emitter->rate_remainder;
+    if (count > 0) {
+      emitter->rate_remainder -= count;
+      particle_emitter_burst(emitter, emitter->p, count);
+    }
+  }
+
+  DEBUG_FUNCTION_END();
+}
@@ -0,0 +1,105 @@
+#ifndef PARTICLE_H
+
+// NOTE(lvl5): included from renderer.h, after Sprite.
+// Particles are SoA so the simulation can do PARTICLE_LANES of them at a
+// time. Every array is aligned and padded to whole lanes, the padding
+// gets simulated along with the rest and nobody reads it.
+// z is gone, the quads are 2d and it was always 0 anyway
+
+// NOTE(lvl5): 8 lanes needs avx2, the random streams are integer math
+#if defined(__AVX2__)
+#define PARTICLE_LANES 8
+#else
+#define PARTICLE_LANES 4
+#endif
+
+#define PARTICLE_STREAM_COUNT 19
+
+// NOTE(lvl5): what new particles look like. Every field is picked
+// uniformly between its min and max, p is relative to where they're emitted
+typedef struct {
+  v2 p_min;
+  v2 p_max;
+  v2 scale_min;
+  v2 scale_max;
+  f32 angle_min;
+  f32 angle_max;
+  v4 color_min;
+  v4 color_max;
+
+  v2 d_p_min;
+  v2 d_p_max;
+  v2 d_scale_min;
+  v2 d_scale_max;
+  f32 d_angle_min;
+  f32 d_angle_max;
+  v4 d_color_min;
+  v4 d_color_max;
+
+  f32 lifetime_min;
+  f32 lifetime_max;
+
+  f32 rate; // NOTE(lvl5): particles per second at p, on top of the bursts
+} Particle_Emitter_Desc;
+
+typedef struct {
+  Sprite sprite;
+  i32 particle_count;
+  i32 particle_capacity;
+
+  Particle_Emitter_Desc desc;
+  v2 p;
+  f32 rate_remainder;
+  u32 rand_lanes[PARTICLE_LANES]; // NOTE(lvl5): a xorshift32 per lane
+
+  union {
+    struct {
+      f32 *p_x;
+      f32 *p_y;
+      f32 *d_p_x;
+      f32 *d_p_y;
+      f32 *scale_x;
+      f32 *scale_y;
+      f32 *d_scale_x;
+      f32 *d_scale_y;
+      f32 *angle;
+      f32 *d_angle;
+      f32 *r;
+      f32 *g;
+      f32 *b;
+      f32 *a;
+      f32 *d_r;
+      f32 *d_g;
+      f32 *d_b;
+      f32 *d_a;
+      f32 *lifetime;
+    };
+    f32 *streams[PARTICLE_STREAM_COUNT];
+  };
+} Particle_Emitter;
+
+// NOTE(lvl5): the emitters that get simulated every frame. Rendering one
+// is push_particle_emitter, it only reads it.
+// Emitters are split into chunks of PARTICLE_CHUNK_SIZE, and all the
+// chunks of all the emitters run on the high priority queue at once, a
+// few chunks per queue entry
+#define PARTICLE_SYSTEM_MAX_EMITTERS 64
+#define PARTICLE_CHUNK_SIZE (PARTICLE_LANES*4096)
+
+typedef struct {
+  Particle_Emitter *emitters[PARTICLE_SYSTEM_MAX_EMITTERS];
+  i32 emitter_count;
+} Particle_System;
+
+// NOTE(lvl5): like the entity batches, a chunk only touches its own range
+// of particles and can't use the debug system or allocate
+typedef struct {
+  Particle_Emitter *emitter;
+  i32 begin;
+  i32 end;
+  i32 live_end; // NOTE(lvl5): the survivors are [begin, live_end) afterwards
+  f32 dt;
+} Particle_Chunk;
+
+#define PARTICLE_H
+#endif
@@ -5,8 +5,19 @@
 
 #define SAMPLES_PER_SECOND 44100
 
+#if defined(_MSC_VER)
 #define complete_past_writes_before_future_writes() _WriteBarrier()
 #define complete_past_reads_before_future_reads() _ReadBarrier()
+#else
+#include <stdio.h>
+#include <x86intrin.h>
+#define complete_past_writes_before_future_writes() __asm__ __volatile__("" ::: "memory")
+#define complete_past_reads_before_future_reads() __asm__ __volatile__("" ::: "memory")
+
+// NOTE(lvl5): the bounds-checked CRT functions are msvc only
+#define sprintf_s snprintf
+#define vsprintf_s vsnprintf
+#endif
 
 
 
@@ -57,6 +68,9 @@ typedef struct {
   
   b32 is_reloaded;
   b32 window_resized;
+  // NOTE(lvl5): perm was mapped from an image of an earlier run, everything
+  // in it is initialized but gpu objects, temp and debug are not
+  b32 is_restored;
   
   byte *perm;
   Mem_Size perm_size;
@@ -125,6 +139,11 @@ typedef struct _Work_Queue *Work_Queue;
 #define PLATFORM_ADD_WORK_QUEUE_ENTRY(name) void name(Work_Queue queue_ptr, Worker_Fn *fn, void *data)
 typedef PLATFORM_ADD_WORK_QUEUE_ENTRY(Platform_Add_Work_Queue_Entry);
 
+// NOTE(lvl5): the calling thread helps with the work until every entry
+// added so far is finished
+#define PLATFORM_COMPLETE_ALL_WORK(name) void name(Work_Queue queue_ptr)
+typedef PLATFORM_COMPLETE_ALL_WORK(Platform_Complete_All_Work);
+
 #define PLATFORM_GET_TIME(name) f64 name()
 typedef PLATFORM_GET_TIME(Platform_Get_Time);
 
@@ -140,6 +159,7 @@ typedef struct {
   Platform_Read_File *read_file;
   Platform_Close_File *close_file;
   Platform_Add_Work_Queue_Entry *add_work_queue_entry;
+  Platform_Complete_All_Work *complete_all_work;
   Work_Queue high_queue;
   Work_Queue low_queue;
 } Platform;
@@ -152,6 +172,12 @@ globalvar Platform platform;
 Input *input, f32 dt, Platform _platform)
 typedef GAME_UPDATE(Game_Update);
 
+// NOTE(lvl5): only the part of game_update that changes perm, for rerunning
+// frames that were already shown. Nothing gets drawn, mixed or profiled
+#define GAME_SIMULATE(name) void name(v2 screen_size, Memory memory, \
+Input *input, f32 dt, Platform _platform)
+typedef GAME_SIMULATE(Game_Simulate);
+
 
 #define PLATFORM_H
 #endif
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include "debug.h"
 #define PIXELS_PER_METER 32
 #include "font.c"
+#include "particle.c"
 
 mat4 transform_apply(mat4 matrix, Transform t) {
   mat4 result = matrix;
@@ -76,6 +77,11 @@ void render_font(Render_Group *group, Font *font) {
   group->state.font = font;
 }
 
+void render_layer(Render_Group *group, i32 layer) {
+  assert(layer >= 0 && layer < RENDER_LAYER_COUNT);
+  group->state.layer = layer;
+}
+
 
 rect2i sprite_get_rect(Sprite spr) {
   rect2i result = spr.atlas->rects[spr.index];
@@ -191,12 +197,11 @@ void push_text(Render_Group *group, String text) {
 }
 
 
-void push_particle_emitter(Render_Group *group, Particle_Emitter *emitter, f32 dt) {
+void push_particle_emitter(Render_Group *group, Particle_Emitter *emitter) {
   DEBUG_FUNCTION_BEGIN();
   
   Render_Particle_Emitter *entry = push_render_item(group, Particle_Emitter);
   entry->emitter = emitter;
-  entry->dt = dt;
   group->expected_quad_count += emitter->particle_count - 1; 
   
   DEBUG_FUNCTION_END();
@@ -204,12 +209,61 @@ void push_particle_emitter(Render_Group *group, Particle_Emitter *emitter, f32 d
 
 
 
+// NOTE(lvl5): points the instance attributes at offset in vbo. There is no
+// base instance in 3.3, so every draw out of the ring sets them again
+void quad_renderer_set_instances(Quad_Renderer *renderer, u32 vbo, Mem_Size offset) {
+  byte *base = (byte *)offset;
+  gl.BindVertexArray(renderer->vao);
+  gl.BindBuffer(GL_ARRAY_BUFFER, vbo);
+  // NOTE(lvl5): x_axis and y_axis go in as one vec4
+  gl.VertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Quad_Instance),
+                         base + offsetof(Quad_Instance, x_axis));
+  gl.VertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Quad_Instance),
+                         base + offsetof(Quad_Instance, p));
+  gl.VertexAttribPointer(3, 4, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(Quad_Instance),
+                         base + offsetof(Quad_Instance, tex_x));
+  gl.VertexAttribPointer(4, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Quad_Instance),
+                         base + offsetof(Quad_Instance, color));
+}
+
+void quad_renderer_init_ring(Quad_Instance_Ring *ring) {
+  ring->segment = -1;
+  gl.GenBuffers(1, &ring->vbo);
+  gl.BindBuffer(GL_ARRAY_BUFFER, ring->vbo);
+  
+  // NOTE(lvl5): the platform leaves the 4.4 functions null when there's no 4.4.
+  // Without MapBufferRange the ring goes unused, every group takes the
+  // overflow path through instance_vbo
+  b32 has_map = gl.MapBufferRange && gl.UnmapBuffer;
+  b32 has_storage = has_map && gl.BufferStorage && gl.FenceSync &&
+    gl.ClientWaitSync && gl.DeleteSync;
+  if (has_storage) {
+    GLbitfield flags = GL_MAP_WRITE_BIT|GL_MAP_PERSISTENT_BIT|GL_MAP_COHERENT_BIT;
+    gl.BufferStorage(GL_ARRAY_BUFFER, QUAD_RENDERER_RING_SIZE, null, flags);
+    ring->persistent_data = (byte *)gl.MapBufferRange(GL_ARRAY_BUFFER, 0,
+                                                      QUAD_RENDERER_RING_SIZE, flags);
+    if (!ring->persistent_data) {
+      // NOTE(lvl5): storage can't be respecified, start over with a new buffer
+      gl.DeleteBuffers(1, &ring->vbo);
+      gl.GenBuffers(1, &ring->vbo);
+      gl.BindBuffer(GL_ARRAY_BUFFER, ring->vbo);
+    }
+  }
+  
+  if (!ring->persistent_data && has_map) {
+    gl.BufferData(GL_ARRAY_BUFFER, QUAD_RENDERER_RING_SIZE, null, GL_STREAM_DRAW);
+  }
+}
+
 void quad_renderer_init(Quad_Renderer *renderer, State *state) {
+  // NOTE(lvl5): only called in a fresh process, there's nothing to delete
+  zero_memory_slow(renderer, sizeof(Quad_Renderer));
   renderer->shader = state->shader_basic;
   
   gl.GenBuffers(1, &renderer->vertex_vbo);
   gl.GenBuffers(1, &renderer->instance_vbo);
   gl.GenVertexArrays(1, &renderer->vao);
+  quad_renderer_init_ring(&renderer->ring);
   
   // NOTE(lvl5): data layout
   gl.BindVertexArray(renderer->vao);
@@ -217,37 +271,17 @@ void quad_renderer_init(Quad_Renderer *renderer, State *state) {
   gl.VertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Quad_Vertex), (void *)offsetof(Quad_Vertex, p));
   gl.EnableVertexAttribArray(0);
   
-  u64 v4_size = sizeof(v4);
-  u64 model_offset = offsetof(Quad_Instance, model);
-  
-  gl.BindBuffer(GL_ARRAY_BUFFER, renderer->instance_vbo);
-  gl.VertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Quad_Instance),
-                         (void *)(model_offset+0*v4_size));
-  gl.VertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(Quad_Instance),
-                         (void *)(model_offset+1*v4_size));
-  gl.VertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(Quad_Instance),
-                         (void *)(model_offset+2*v4_size));
-  gl.VertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(Quad_Instance),
-                         (void *)(model_offset+3*v4_size));
-  
-  gl.VertexAttribPointer(5, 4, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(Quad_Instance),
-                         (void *)offsetof(Quad_Instance, tex_x));
-  gl.VertexAttribPointer(6, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Quad_Instance),
-                         (void *)offsetof(Quad_Instance, color));
+  quad_renderer_set_instances(renderer, renderer->ring.vbo, 0);
   
   gl.EnableVertexAttribArray(1);
   gl.EnableVertexAttribArray(2);
   gl.EnableVertexAttribArray(3);
   gl.EnableVertexAttribArray(4);
-  gl.EnableVertexAttribArray(5);
-  gl.EnableVertexAttribArray(6);
   
   gl.VertexAttribDivisor(1, 1);
   gl.VertexAttribDivisor(2, 1);
   gl.VertexAttribDivisor(3, 1);
   gl.VertexAttribDivisor(4, 1);
-  gl.VertexAttribDivisor(5, 1);
-  gl.VertexAttribDivisor(6, 1);
   gl.BindVertexArray(null);
   
   // NOTE(lvl5): buffer data
@@ -262,37 +296,210 @@ void quad_renderer_init(Quad_Renderer *renderer, State *state) {
   gl.BindBuffer(GL_ARRAY_BUFFER, renderer->vertex_vbo);
   gl.BufferData(GL_ARRAY_BUFFER, array_count(vertices)*sizeof(Quad_Vertex), 
                 vertices, GL_STATIC_DRAW);
-  
-  gl.GenTextures(1, &renderer->texture);
-  gl.BindTexture(GL_TEXTURE_2D, renderer->texture);
-#if 1
-  gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-#endif
 }
 
 void quad_renderer_destroy(Quad_Renderer *renderer) {
+  Quad_Instance_Ring *ring = &renderer->ring;
+  if (ring->persistent_data) {
+    gl.BindBuffer(GL_ARRAY_BUFFER, ring->vbo);
+    gl.UnmapBuffer(GL_ARRAY_BUFFER);
+  }
+  for (i32 segment_index = 0; segment_index < array_count(ring->fences); segment_index++) {
+    if (ring->fences[segment_index]) {
+      gl.DeleteSync(ring->fences[segment_index]);
+    }
+  }
+  gl.DeleteBuffers(1, &ring->vbo);
+  
   gl.DeleteBuffers(1, &renderer->instance_vbo);
   gl.DeleteBuffers(1, &renderer->vertex_vbo);
   gl.DeleteVertexArrays(1, &renderer->vao);
-  gl.DeleteTextures(1, &renderer->texture);
+  for (i32 texture_index = 0; texture_index < renderer->texture_count; texture_index++) {
+    gl.DeleteTextures(1, &renderer->textures[texture_index].texture);
+  }
   zero_memory_slow(renderer, sizeof(Quad_Renderer));
 }
 
-void quad_renderer_draw(Quad_Renderer *renderer, Bitmap *bmp,
-                        mat4 view_mat, mat4 projection_mat, Quad_Instance *instances, u32 instance_count) {
+void quad_renderer_wait_segment(Quad_Instance_Ring *ring, i32 segment) {
+  GLsync fence = ring->fences[segment];
+  if (fence) {
+    DEBUG_SECTION_BEGIN(_ring_wait);
+    // NOTE(lvl5): 1ms at a time. The fences never leave the renderer, so a
+    // failed wait is a bug, not a fence from before a restore
+    GLenum wait_result;
+    do {
+      wait_result = gl.ClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+    } while (wait_result == GL_TIMEOUT_EXPIRED);
+    assert(wait_result != GL_WAIT_FAILED);
+    gl.DeleteSync(fence);
+    ring->fences[segment] = 0;
+    DEBUG_SECTION_END(_ring_wait);
+  }
+}
+
+// NOTE(lvl5): room for count instances, write only, it can be
+// write-combined gpu memory. quad_renderer_unmap_instances has to come
+// before the draws
+Quad_Instance *quad_renderer_map_instances(Quad_Renderer *renderer, Arena *arena, i32 count) {
   DEBUG_FUNCTION_BEGIN();
   
-  DEBUG_SECTION_BEGIN(_buffer_data);
-  gl.BindBuffer(GL_ARRAY_BUFFER, renderer->instance_vbo);
-  gl.BufferData(GL_ARRAY_BUFFER, instance_count*sizeof(Quad_Instance),
-                instances, GL_DYNAMIC_DRAW);
-  DEBUG_SECTION_END(_buffer_data);
+  Quad_Instance_Ring *ring = &renderer->ring;
+  Mem_Size size = count*sizeof(Quad_Instance);
+  Quad_Instance *result = 0;
+  ring->map_size = 0;
+  ring->overflow_instances = 0;
+  
+  if (size && size <= QUAD_RENDERER_RING_SIZE) {
+    Mem_Size segment_size = QUAD_RENDERER_RING_SIZE/QUAD_RENDERER_RING_SEGMENTS;
+    Mem_Size offset = (ring->head + QUAD_RENDERER_RING_ALIGN - 1) &
+      ~(Mem_Size)(QUAD_RENDERER_RING_ALIGN - 1);
+    b32 wrapped = offset + size > QUAD_RENDERER_RING_SIZE;
+    if (wrapped) {
+      offset = 0;
+      ring->segment = -1;
+    }
+    
+    gl.BindBuffer(GL_ARRAY_BUFFER, ring->vbo);
+    if (ring->persistent_data) {
+      // NOTE(lvl5): the segment head is in was already waited on when we got to it
+      i32 first_segment = (i32)(offset/segment_size);
+      i32 last_segment = (i32)((offset + size - 1)/segment_size);
+      for (i32 segment = first_segment; segment <= last_segment; segment++) {
+        if (segment != ring->segment) {
+          quad_renderer_wait_segment(ring, segment);
+        }
+      }
+      ring->segment = last_segment;
+      result = (Quad_Instance *)(ring->persistent_data + offset);
+    } else if (gl.MapBufferRange && gl.UnmapBuffer) {
+      if (wrapped) {
+        gl.BufferData(GL_ARRAY_BUFFER, QUAD_RENDERER_RING_SIZE, null, GL_STREAM_DRAW);
+      }
+      result = (Quad_Instance *)gl.MapBufferRange(GL_ARRAY_BUFFER, offset, size,
+                                                  GL_MAP_WRITE_BIT|
+                                                  GL_MAP_INVALIDATE_RANGE_BIT|
+                                                  GL_MAP_UNSYNCHRONIZED_BIT);
+    }
+    
+    if (result) {
+      ring->map_offset = offset;
+      ring->map_size = size;
+      ring->head = offset + size;
+    }
+  }
   
+  if (!result) {
+    result = arena_push_array(arena, Quad_Instance, count);
+    ring->overflow_instances = result;
+  }
   
-  DEBUG_SECTION_BEGIN(_set_texture);
-  gl.TexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bmp->width, bmp->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, bmp->data);
+  DEBUG_FUNCTION_END();
+  return result;
+}
+
+// NOTE(lvl5): false when the driver lost what was written, skip the draws then
+b32 quad_renderer_unmap_instances(Quad_Renderer *renderer, i32 count) {
+  Quad_Instance_Ring *ring = &renderer->ring;
+  b32 result = true;
+  if (ring->overflow_instances) {
+    gl.BindBuffer(GL_ARRAY_BUFFER, renderer->instance_vbo);
+    gl.BufferData(GL_ARRAY_BUFFER, count*sizeof(Quad_Instance),
+                  ring->overflow_instances, GL_STREAM_DRAW);
+  } else if (ring->map_size) {
+    assert(count*sizeof(Quad_Instance) <= ring->map_size);
+    // NOTE(lvl5): the next group can start where this one really ended.
+    // The segments past that were waited on and stay free until we're back
+    ring->head = ring->map_offset + count*sizeof(Quad_Instance);
+    Mem_Size segment_size = QUAD_RENDERER_RING_SIZE/QUAD_RENDERER_RING_SEGMENTS;
+    Mem_Size last_byte = ring->head > ring->map_offset ? ring->head - 1 : ring->map_offset;
+    ring->segment = (i32)(last_byte/segment_size);
+    if (!ring->persistent_data) {
+      gl.BindBuffer(GL_ARRAY_BUFFER, ring->vbo);
+      result = gl.UnmapBuffer(GL_ARRAY_BUFFER);
+    }
+  }
+  return result;
+}
+
+// NOTE(lvl5): after the draws, fences what they read
+void quad_renderer_retire_instances(Quad_Renderer *renderer) {
+  Quad_Instance_Ring *ring = &renderer->ring;
+  if (ring->persistent_data && ring->map_size && ring->head > ring->map_offset) {
+    Mem_Size segment_size = QUAD_RENDERER_RING_SIZE/QUAD_RENDERER_RING_SEGMENTS;
+    i32 first_segment = (i32)(ring->map_offset/segment_size);
+    i32 last_segment = (i32)((ring->head - 1)/segment_size);
+    for (i32 segment = first_segment; segment <= last_segment; segment++) {
+      if (ring->fences[segment]) {
+        gl.DeleteSync(ring->fences[segment]);
+      }
+      ring->fences[segment] = gl.FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+  }
+  ring->map_size = 0;
+  ring->overflow_instances = 0;
+}
+
+// NOTE(lvl5): binds the atlas texture, uploading it only if it's new or changed
+void quad_renderer_bind_atlas(Quad_Renderer *renderer, Texture_Atlas *atlas) {
+  Quad_Renderer_Texture *tex = 0;
+  for (i32 texture_index = 0; texture_index < renderer->texture_count; texture_index++) {
+    if (renderer->textures[texture_index].atlas == atlas) {
+      tex = renderer->textures + texture_index;
+      break;
+    }
+  }
   
+  if (!tex) {
+    if (renderer->texture_count < array_count(renderer->textures)) {
+      tex = renderer->textures + renderer->texture_count++;
+      gl.GenTextures(1, &tex->texture);
+      gl.BindTexture(GL_TEXTURE_2D, tex->texture);
+      gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    } else {
+      // NOTE(lvl5): more atlases than slots, reuse the gl texture of another one
+      tex = renderer->textures + renderer->next_evicted_texture;
+      renderer->next_evicted_texture = (renderer->next_evicted_texture + 1) %
+        array_count(renderer->textures);
+    }
+    tex->atlas = atlas;
+    tex->data = 0;
+  }
+  
+  Bitmap *bmp = &atlas->bmp;
+  gl.BindTexture(GL_TEXTURE_2D, tex->texture);
+  if (tex->data != bmp->data ||
+      tex->width != bmp->width ||
+      tex->height != bmp->height ||
+      tex->generation != atlas->generation) {
+    gl.TexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bmp->width, bmp->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, bmp->data);
+    tex->data = bmp->data;
+    tex->width = bmp->width;
+    tex->height = bmp->height;
+    tex->generation = atlas->generation;
+  }
+}
+
+// NOTE(lvl5): draws instances [first, first+count) of the group that was
+// mapped last
+void quad_renderer_draw(Quad_Renderer *renderer, Texture_Atlas *atlas,
+                        mat4 view_mat, mat4 projection_mat, i32 first, i32 count) {
+  DEBUG_FUNCTION_BEGIN();
+  
+  DEBUG_SECTION_BEGIN(_set_instances);
+  Quad_Instance_Ring *ring = &renderer->ring;
+  if (ring->overflow_instances) {
+    quad_renderer_set_instances(renderer, renderer->instance_vbo,
+                                first*sizeof(Quad_Instance));
+  } else {
+    quad_renderer_set_instances(renderer, ring->vbo,
+                                ring->map_offset + first*sizeof(Quad_Instance));
+  }
+  DEBUG_SECTION_END(_set_instances);
+  
+  
+  DEBUG_SECTION_BEGIN(_set_texture);
+  quad_renderer_bind_atlas(renderer, atlas);
   
   gl.UseProgram(renderer->shader);
   gl_set_uniform_mat4(gl, renderer->shader, "u_projection", &projection_mat, 1);
@@ -300,8 +507,7 @@ void quad_renderer_draw(Quad_Renderer *renderer, Bitmap *bmp,
   DEBUG_SECTION_END(_set_texture);
   
   DEBUG_SECTION_BEGIN(_draw_call);
-  gl.BindVertexArray(renderer->vao);
-  gl.DrawArraysInstanced(GL_TRIANGLES, 0, 6, instance_count);
+  gl.DrawArraysInstanced(GL_TRIANGLES, 0, 6, count);
   DEBUG_SECTION_END(_draw_call);
   
   DEBUG_FUNCTION_END();
@@ -349,67 +555,27 @@ mat4 camera_get_projection_matrix(Camera *camera, v2 screen_size) {
   return result;
 }
 
-
-void particle_emitter_init(Arena *arena, Particle_Emitter *emitter, Sprite sprite, i32 capacity) {
-  Particle_Emitter zero_emitter = {0};
-  *emitter = zero_emitter;
-  emitter->particles = arena_push_array(arena, Particle, capacity);
-  emitter->particle_capacity = capacity;
-  emitter->sprite = sprite;
-}
-
-// TODO(lvl5): random value settings
-void particle_emitter_emit(Particle_Emitter *emitter, Rand *rand, v3 pos, i32 count) {
-  v3 pos_min = V3(-0.1f, -0.1f, 0);
-  v3 pos_max = V3(0.1f, 0.1f, 0);
-  v3 scale_min = V3(0.1f, 0.1f, 0);
-  v3 scale_max = V3(0.5f, 0.5f, 0);
-  f32 angle_min = -PI;
-  f32 angle_max = PI;
-  v4 color_min = V4(0, 0, 0, 1);
-  v4 color_max = V4(1, 1, 1, 1);
-  
-  v3 d_pos_min = V3(-4, -4, 0);
-  v3 d_pos_max = V3(4, 4, 0);
-  v3 d_scale_min = V3(-0.1f, -0.1f, 0);
-  v3 d_scale_max = V3(-0.02f, -0.02f, 0);
-  f32 d_angle_min = 1.0f;
-  f32 d_angle_max = -1.0f;
-  v4 d_color_min = V4(0.01f, 0.01f, 0.01f, -0.1f);
-  v4 d_color_max = V4(-0.01f, -0.01f, -0.01f, -0.5f);
-  
-  f32 lifetime_min = 2.0f;
-  f32 lifetime_max = 5.0f;
-  
-  
-  assert(emitter->particle_count + count <= emitter->particle_capacity);
-  for (i32 particle_index = 0;
-       particle_index < count;
-       particle_index++) {
-    Particle *p = emitter->particles + emitter->particle_count++;
-    p->t.p = v3_add(pos, random_range_v3(rand, pos_min, pos_max));
-    p->t.angle = random_range(rand, angle_min, angle_max);
-    p->t.scale = random_range_v3(rand, scale_min, scale_max);
-    p->color = random_range_v4(rand, color_min, color_max);
-    
-    p->d_t.p = random_range_v3(rand, d_pos_min, d_pos_max);
-    p->d_t.angle = random_range(rand, d_angle_min, d_angle_max);
-    p->d_t.scale = random_range_v3(rand, d_scale_min, d_scale_max);
-    p->d_color = random_range_v4(rand, d_color_min, d_color_max);
-    
-    p->lifetime = random_range(rand, lifetime_min, lifetime_max);
-  }
+// NOTE(lvl5): what the view and projection above show, in world space.
+// For a rotated camera it's the box around the rotated rect
+rect2 camera_get_visible_rect(Camera *camera, v2 screen_size) {
+  v2 half_x = v2_rotate(V2(camera->scale.x*screen_size.x*0.5f, 0), camera->angle);
+  v2 half_y = v2_rotate(V2(0, camera->scale.y*screen_size.y*0.5f), camera->angle);
+  v2 extent = V2(abs_f32(half_x.x) + abs_f32(half_y.x),
+                 abs_f32(half_x.y) + abs_f32(half_y.y));
+  rect2 result = rect2_min_max(v2_sub(camera->p.xy, extent),
+                               v2_add(camera->p.xy, extent));
+  return result;
 }
 
-void particle_emitter_remove_particle(Particle_Emitter *emitter, i32 index) {
-  Particle *last = emitter->particles + emitter->particle_count - 1;
-  Particle *removed = emitter->particles + index;
-  *removed = *last;
-  emitter->particle_count--;
+
+void set_instance_model(Quad_Instance *inst, mat4 model_m) {
+  inst->x_axis = V2(model_m.e00, model_m.e01);
+  inst->y_axis = V2(model_m.e10, model_m.e11);
+  inst->p = V2(model_m.e30, model_m.e31);
 }
 
 void set_instance_params(Quad_Instance *inst, mat4 model_m, Texture_Atlas *atlas, rect2i tex_rect, v4 color) {
-  inst->model = model_m;
+  set_instance_model(inst, model_m);
   v2i size = rect2i_get_size(tex_rect);
   
   inst->tex_x = (u16)tex_rect.min.x;
@@ -419,155 +585,393 @@ void set_instance_params(Quad_Instance *inst, mat4 model_m, Texture_Atlas *atlas
   inst->color = color_v4_to_u32(color);
 }
 
-void render_group_output(Arena *arena, Render_Group *group, Quad_Renderer *renderer) {
-  DEBUG_FUNCTION_BEGIN();
-  
-  assert(group->state_stack_count == 0);
-  
-  if (group->item_count == 0) {
-    return;
+Texture_Atlas *render_item_get_atlas(Render_Item *item) {
+  Texture_Atlas *result = 0;
+  switch (item->type) {
+    case Render_Type_Sprite: {
+      result = item->Sprite.sprite.atlas;
+    } break;
+    case Render_Type_Particle_Emitter: {
+      result = item->Particle_Emitter.emitter->sprite.atlas;
+    } break;
+    case Render_Type_Text: {
+      result = &item->state.font->atlas;
+    } break;
+    default: assert(false);
   }
+  return result;
+}
+
+// NOTE(lvl5): bottom-up merge sort, the keys are unique so it doesn't
+// need to be stable. Returns whichever buffer ended up sorted
+u64 *render_sort_keys(u64 *keys, u64 *temp, i32 count) {
+  u64 *src = keys;
+  u64 *dst = temp;
+  for (i32 width = 1; width < count; width *= 2) {
+    for (i32 start = 0; start < count; start += 2*width) {
+      i32 mid = start + width < count ? start + width : count;
+      i32 end = start + 2*width < count ? start + 2*width : count;
+      i32 a = start;
+      i32 b = mid;
+      for (i32 out = start; out < end; out++) {
+        if (a < mid && (b >= end || src[a] < src[b])) {
+          dst[out] = src[a++];
+        } else {
+          dst[out] = src[b++];
+        }
+      }
+    }
+    u64 *swap = src;
+    src = dst;
+    dst = swap;
+  }
+  return src;
+}
+
+// NOTE(lvl5): key is (layer, atlas rank in the layer, item index)
+u64 *render_group_sort_items(Arena *arena, Render_Group *group) {
+  DEBUG_FUNCTION_BEGIN();
   
-  Quad_Instance *instances = arena_push_array(arena, Quad_Instance, group->expected_quad_count);
-  i32 instance_count = 0;
-  
-  Texture_Atlas *atlas = 0;
-  
-#define DUMP_QUADS() \
-  mat4 view_matrix = camera_get_view_matrix(group->camera); \
-  mat4 projection_matrix =  camera_get_projection_matrix(group->camera, group->screen_size); \
-  quad_renderer_draw(renderer, &atlas->bmp, view_matrix, projection_matrix, instances, instance_count); \
-  instance_count = 0;
+  u64 *keys = arena_push_array(arena, u64, group->item_count);
+  u64 *temp = arena_push_array(arena, u64, group->item_count);
+  
+  // NOTE(lvl5): one entry per (layer, atlas) pair in the order they show
+  // up, there can't be more of them than items. Runs of the same pair
+  // are the common case, so the last one is checked before searching
+  typedef struct {
+    i32 layer;
+    Texture_Atlas *atlas;
+    i32 rank;
+  } Render_Atlas_Rank;
+  Render_Atlas_Rank *ranks = arena_push_array(arena, Render_Atlas_Rank, group->item_count);
+  i32 rank_count = 0;
+  Render_Atlas_Rank *last = 0;
   
-  DEBUG_SECTION_BEGIN(_push_instances);
   for (i32 item_index = 0; item_index < group->item_count; item_index++) {
     Render_Item *item = group->items + item_index;
-    switch (item->type) {
-      case Render_Type_Sprite: {
-        Sprite sprite = item->Sprite.sprite;
-        
-        if (atlas && atlas != sprite.atlas) {
-          DUMP_QUADS();
+    Texture_Atlas *atlas = render_item_get_atlas(item);
+    i32 layer = item->state.layer;
+    
+    if (!last || last->layer != layer || last->atlas != atlas) {
+      i32 layer_rank_count = 0;
+      last = 0;
+      for (i32 rank_index = 0; rank_index < rank_count; rank_index++) {
+        Render_Atlas_Rank *r = ranks + rank_index;
+        if (r->layer == layer) {
+          if (r->atlas == atlas) {
+            last = r;
+            break;
+          }
+          layer_rank_count++;
         }
+      }
+      if (!last) {
+        assert(layer_rank_count < 0x10000);
+        last = ranks + rank_count++;
+        last->layer = layer;
+        last->atlas = atlas;
+        last->rank = layer_rank_count;
+      }
+    }
+    i32 rank = last->rank;
+    
+    keys[item_index] = ((u64)layer << 48) | ((u64)rank << 32) | (u64)item_index;
+  }
+  
+  u64 *result = render_sort_keys(keys, temp, group->item_count);
+  
+  DEBUG_FUNCTION_END();
+  return result;
+}
+
+i32 render_item_get_quad_count(Render_Item *item) {
+  i32 result = 0;
+  switch (item->type) {
+    case Render_Type_Sprite: {
+      result = 1;
+    } break;
+    case Render_Type_Particle_Emitter: {
+      result = item->Particle_Emitter.emitter->particle_count;
+    } break;
+    case Render_Type_Text: {
+      result = (i32)item->Text.text.count;
+    } break;
+    default: assert(false);
+  }
+  return result;
+}
+
+// NOTE(lvl5): instance generation. The quads of the sorted items are
+// numbered with a prefix sum, and every job gets one range of those
+// numbers inside a single batch, so the jobs write disjoint parts of the
+// instance buffer. A job keeps only the quads that touch visible_rect,
+// packed at the start of its range.
+// Like the entity batches, a job can't use the debug system or allocate
+
+typedef struct {
+  Render_Group *group;
+  u64 *sorted_keys;
+  i32 *item_firsts; // NOTE(lvl5): first quad of each sorted item, and the total
+  Quad_Instance *instances;
+  rect2 visible_rect;
+  Texture_Atlas *atlas;
+  i32 begin;
+  i32 end;
+  i32 write; // NOTE(lvl5): the visible quads are [begin, write) afterwards
+} Render_Instance_Job;
+
+#define RENDER_MAX_INSTANCE_JOBS 64
+#define RENDER_MIN_INSTANCE_JOB_SIZE 4096
+
+// NOTE(lvl5): the box around the parallelogram the unit quad turns into
+b32 render_quad_is_visible(rect2 visible_rect, Quad_Instance *inst) {
+  v2 x = inst->x_axis;
+  v2 y = inst->y_axis;
+  f32 min_x = inst->p.x + (x.x < 0 ? x.x : 0) + (y.x < 0 ? y.x : 0);
+  f32 max_x = inst->p.x + (x.x > 0 ? x.x : 0) + (y.x > 0 ? y.x : 0);
+  f32 min_y = inst->p.y + (x.y < 0 ? x.y : 0) + (y.y < 0 ? y.y : 0);
+  f32 max_y = inst->p.y + (x.y > 0 ? x.y : 0) + (y.y > 0 ? y.y : 0);
+  b32 result = max_x >= visible_rect.min.x && min_x <= visible_rect.max.x &&
+    max_y >= visible_rect.min.y && min_y <= visible_rect.max.y;
+  return result;
+}
+
+void render_job_push_instance(Render_Instance_Job *job, Quad_Instance *inst) {
+  if (render_quad_is_visible(job->visible_rect, inst)) {
+    // NOTE(lvl5): one whole copy, it can be write-combined memory
+    job->instances[job->write++] = *inst;
+  }
+}
+
+// NOTE(lvl5): pushes quads [first, first+count) of the item
+void render_item_write_instances(Render_Instance_Job *job, Render_Item *item,
+                                 i32 first, i32 count) {
+  Render_Group *group = job->group;
+  switch (item->type) {
+    case Render_Type_Sprite: {
+      Sprite sprite = item->Sprite.sprite;
+      mat4 model_m = item->state.matrix;
+      rect2i tex_rect = sprite_get_rect(sprite);
+      Quad_Instance inst;
+      set_instance_params(&inst, model_m, sprite.atlas, tex_rect, item->state.color);
+      render_job_push_instance(job, &inst);
+    } break;
+    
+    case Render_Type_Particle_Emitter: {
+      Particle_Emitter *emitter = item->Particle_Emitter.emitter;
+      mat4 model_m = item->state.matrix;
+      rect2i tex_rect = sprite_get_rect(emitter->sprite);
+      v2i size = rect2i_get_size(tex_rect);
+      
+      Quad_Instance inst;
+      inst.tex_x = (u16)tex_rect.min.x;
+      inst.tex_y = (u16)tex_rect.min.y;
+      inst.tex_width = (u16)size.x;
+      inst.tex_height = (u16)size.y;
+      
+      for (i32 particle_index = first;
+           particle_index < first + count;
+           particle_index++) {
+        mat4 self_m = model_m;
+        // NOTE(lvl5): scale
+        self_m.e00 *= emitter->scale_x[particle_index];
+        self_m.e11 *= emitter->scale_y[particle_index];
         
-        mat4 model_m = item->state.matrix;
-        rect2i tex_rect = sprite_get_rect(sprite);
+        // NOTE(lvl5): rotate
+        self_m = mat4_rotate(self_m, emitter->angle[particle_index]);
         
-        Quad_Instance *inst = instances + instance_count++;
-        set_instance_params(inst, model_m, sprite.atlas, tex_rect, item->state.color);
+        // NOTE(lvl5): translate
+        self_m.e30 += emitter->p_x[particle_index];
+        self_m.e31 += emitter->p_y[particle_index];
         
-        atlas = sprite.atlas;
-      } break;
+        set_instance_model(&inst, self_m);
+        inst.color = color_v4_to_u32(V4(emitter->r[particle_index],
+                                        emitter->g[particle_index],
+                                        emitter->b[particle_index],
+                                        emitter->a[particle_index]));
+        render_job_push_instance(job, &inst);
+      }
+    } break;
+    
+    case Render_Type_Text: {
+      Font *font = item->state.font;
+      String text = item->Text.text;
+      mat4 model_m = item->state.matrix;
       
-      case Render_Type_Particle_Emitter: {
-        Particle_Emitter *emitter = item->Particle_Emitter.emitter;
-        if (atlas && emitter->sprite.atlas != atlas) {
-          DUMP_QUADS();
-        }
+#define FONT_SCALE 1.0f
+      
+      // NOTE(lvl5): a job can start in the middle of the text
+      for (i32 char_index = 0; char_index < first; char_index++) {
+        Codepoint_Metrics metrics = font_get_metrics(font, text.data[char_index]);
+        model_m.e30 += metrics.advance*group->camera->scale.x*FONT_SCALE;
+      }
+      
+      for (i32 char_index = first; char_index < first + count; char_index++) {
+        char ch = text.data[char_index];
         
-        DEBUG_SECTION_BEGIN(_particles_render);
+        Codepoint_Metrics metrics = font_get_metrics(font, ch);
+        Sprite spr = font_get_sprite(font, ch);
+        rect2i tex_rect = sprite_get_rect(spr);
         
-        atlas = emitter->sprite.atlas;
-        mat4 model_m = item->state.matrix;
-        rect2i tex_rect = sprite_get_rect(emitter->sprite);
-        v2i size = rect2i_get_size(tex_rect);
-        u16 tex_x = (u16)tex_rect.min.x;
-        u16 tex_y = (u16)tex_rect.min.y;
-        u16 tex_width = (u16)size.x;
-        u16 tex_height = (u16)size.y;
+        v2i size_pixels = rect2i_get_size(tex_rect);
         
-        for (i32 particle_index = 0;
-             particle_index < emitter->particle_count;
-             particle_index++) {
-          Particle *p = emitter->particles + particle_index;
-          
-          DEBUG_SECTION_BEGIN(_particle_calc);
-          mat4 self_m = model_m;
-          // NOTE(lvl5): scale
-          self_m.e00 *= p->t.scale.x;
-          self_m.e11 *= p->t.scale.y;
-          self_m.e22 *= p->t.scale.z;
-          
-          // NOTE(lvl5): rotate
-          self_m = mat4_rotate(self_m, p->t.angle);
-          
-          // NOTE(lvl5): translate
-          self_m.e30 += p->t.p.x;
-          self_m.e31 += p->t.p.y;
-          self_m.e32 += p->t.p.z;
-          
-          Quad_Instance *inst = instances + instance_count++;
-          inst->model = self_m;
-          
-          inst->tex_x = tex_x;
-          inst->tex_y = tex_y;
-          inst->tex_width = tex_width;
-          inst->tex_height = tex_height;
-          inst->color = color_v4_to_u32(p->color);
-          
-          DEBUG_SECTION_END(_particle_calc);
-          
-          DEBUG_SECTION_BEGIN(_particle_simulate);
-          // NOTE(lvl5): simulate
-          f32 dt = item->Particle_Emitter.dt;
-          p->t.p = v3_add(p->t.p, v3_mul(p->d_t.p, dt));
-          p->t.scale = v3_add(p->t.scale, v3_mul(p->d_t.scale, dt));
-          p->t.angle = p->t.angle + p->d_t.angle*dt;
-          p->color = v4_add(p->color, v4_mul(p->d_color, dt));
-          p->lifetime -= dt;
-          
-          if (p->lifetime <= 0 || p->color.a <= 0 || p->t.scale.x <= 0 || p->t.scale.y <= 0) {
-            particle_emitter_remove_particle(emitter, particle_index);
-            particle_index--;
-          }
-          DEBUG_SECTION_END(_particle_simulate);
-        }
-        DEBUG_SECTION_END(_particles_render);
-      } break;
-      
-      case Render_Type_Text: {
-        if (atlas && &item->state.font->atlas != atlas) {
-          DUMP_QUADS();
-        }
+        mat4 self_m = model_m;
         
-        Font *font = item->state.font;
-        String text = item->Text.text;
-        mat4 model_m = item->state.matrix;
+        self_m.e00 = group->camera->scale.x*size_pixels.x*FONT_SCALE;
+        self_m.e11 = group->camera->scale.y*size_pixels.y*FONT_SCALE;
         
-#define FONT_SCALE 1.0f
+        self_m.e30 -= spr.origin.x*group->camera->scale.x*FONT_SCALE;
+        self_m.e31 -= spr.origin.y*group->camera->scale.y*FONT_SCALE;
         
-        for (u32 char_index = 0; char_index < text.count; char_index++) {
-          char ch = text.data[char_index];
-          
-          Codepoint_Metrics metrics = font_get_metrics(font, ch);
-          Sprite spr = font_get_sprite(font, ch);
-          rect2i tex_rect = sprite_get_rect(spr);
-          
-          v2i size_pixels = rect2i_get_size(tex_rect);
-          
-          mat4 self_m = model_m;
-          
-          self_m.e00 = group->camera->scale.x*size_pixels.x*FONT_SCALE;
-          self_m.e11 = group->camera->scale.y*size_pixels.y*FONT_SCALE;
-          
-          self_m.e30 -= spr.origin.x*group->camera->scale.x*FONT_SCALE;
-          self_m.e31 -= spr.origin.y*group->camera->scale.y*FONT_SCALE;
-          
-          Quad_Instance *inst = instances + instance_count++;
-          set_instance_params(inst, self_m, &item->state.font->atlas, tex_rect, item->state.color);
-          
-          model_m.e30 += metrics.advance*group->camera->scale.x*FONT_SCALE;
-        }
+        Quad_Instance inst;
+        set_instance_params(&inst, self_m, &font->atlas, tex_rect, item->state.color);
+        render_job_push_instance(job, &inst);
         
-        atlas = &font->atlas;
-      } break;
-      
-      default: assert(false);
+        model_m.e30 += metrics.advance*group->camera->scale.x*FONT_SCALE;
+      }
+    } break;
+    
+    default: assert(false);
+  }
+}
+
+WORKER_FN(render_instance_job) {
+  Render_Instance_Job *job = (Render_Instance_Job *)data;
+  Render_Group *group = job->group;
+  i32 *item_firsts = job->item_firsts;
+  
+  // NOTE(lvl5): the last item that starts at or before begin. Empty items
+  // share their first with the next one, so that's never an empty one
+  i32 low = 0;
+  i32 high = group->item_count - 1;
+  while (low < high) {
+    i32 mid = (low + high + 1)/2;
+    if (item_firsts[mid] <= job->begin) {
+      low = mid;
+    } else {
+      high = mid - 1;
+    }
+  }
+  
+  job->write = job->begin;
+  i32 quad = job->begin;
+  for (i32 sorted_index = low; quad < job->end; sorted_index++) {
+    Render_Item *item = group->items + (u32)job->sorted_keys[sorted_index];
+    i32 item_first = item_firsts[sorted_index];
+    i32 item_end = item_firsts[sorted_index + 1];
+    i32 end = item_end < job->end ? item_end : job->end;
+    if (end > quad) {
+      render_item_write_instances(job, item, quad - item_first, end - quad);
+      quad = end;
+    }
+  }
+}
+
+void render_group_output(Arena *arena, Render_Group *group, Quad_Renderer *renderer) {
+  DEBUG_FUNCTION_BEGIN();
+  
+  assert(group->state_stack_count == 0);
+  
+  if (group->item_count == 0) {
+    return;
+  }
+  
+  u64 *sorted_keys = render_group_sort_items(arena, group);
+  
+  // NOTE(lvl5): numbers the quads, and splits them into a batch per atlas switch
+  i32 *item_firsts = arena_push_array(arena, i32, group->item_count + 1);
+  Quad_Batch *batches = arena_push_array(arena, Quad_Batch, group->item_count);
+  i32 batch_count = 0;
+  i32 instance_count = 0;
+  
+  for (i32 sorted_index = 0; sorted_index < group->item_count; sorted_index++) {
+    Render_Item *item = group->items + (u32)sorted_keys[sorted_index];
+    Texture_Atlas *atlas = render_item_get_atlas(item);
+    if (batch_count == 0 || batches[batch_count - 1].atlas != atlas) {
+      Quad_Batch *batch = batches + batch_count++;
+      batch->atlas = atlas;
+      batch->first = instance_count;
+      batch->count = 0;
+    }
+    
+    i32 quad_count = render_item_get_quad_count(item);
+    item_firsts[sorted_index] = instance_count;
+    batches[batch_count - 1].count += quad_count;
+    instance_count += quad_count;
+  }
+  item_firsts[group->item_count] = instance_count;
+  
+  Quad_Instance *instances = quad_renderer_map_instances(renderer, arena, instance_count);
+  rect2 visible_rect = camera_get_visible_rect(group->camera, group->screen_size);
+  
+  DEBUG_SECTION_BEGIN(_push_instances);
+  i32 job_size = (instance_count + RENDER_MAX_INSTANCE_JOBS - 1)/RENDER_MAX_INSTANCE_JOBS;
+  if (job_size < RENDER_MIN_INSTANCE_JOB_SIZE) {
+    job_size = RENDER_MIN_INSTANCE_JOB_SIZE;
+  }
+  
+  // NOTE(lvl5): batch boundaries cut jobs short, so at most one extra job per batch
+  Render_Instance_Job *jobs = arena_push_array(arena, Render_Instance_Job,
+                                               RENDER_MAX_INSTANCE_JOBS + batch_count);
+  i32 job_count = 0;
+  for (i32 batch_index = 0; batch_index < batch_count; batch_index++) {
+    Quad_Batch *batch = batches + batch_index;
+    i32 batch_end = batch->first + batch->count;
+    for (i32 begin = batch->first; begin < batch_end; begin += job_size) {
+      Render_Instance_Job *job = jobs + job_count++;
+      job->group = group;
+      job->sorted_keys = sorted_keys;
+      job->item_firsts = item_firsts;
+      job->instances = instances;
+      job->visible_rect = visible_rect;
+      job->atlas = batch->atlas;
+      job->begin = begin;
+      job->end = begin + job_size < batch_end ? begin + job_size : batch_end;
+      job->write = begin;
+    }
+  }
+  
+  // NOTE(lvl5): small groups like the debug gui aren't worth waking anyone
+  if (job_count == 1) {
+    render_instance_job(jobs);
+  } else if (job_count > 1) {
+    for (i32 job_index = 0; job_index < job_count; job_index++) {
+      platform.add_work_queue_entry(platform.high_queue, render_instance_job, jobs + job_index);
     }
+    platform.complete_all_work(platform.high_queue);
   }
   DEBUG_SECTION_END(_push_instances);
   
-  DUMP_QUADS();
+  if (quad_renderer_unmap_instances(renderer, instance_count)) {
+    mat4 view_matrix = camera_get_view_matrix(group->camera);
+    mat4 projection_matrix = camera_get_projection_matrix(group->camera, group->screen_size);
+    
+    // NOTE(lvl5): jobs of the same atlas that kept everything run into the
+    // next one, so without culling it's still one draw per batch
+    Texture_Atlas *draw_atlas = 0;
+    i32 draw_first = 0;
+    i32 draw_count = 0;
+    for (i32 job_index = 0; job_index <= job_count; job_index++) {
+      Render_Instance_Job *job = job_index < job_count ? jobs + job_index : 0;
+      b32 continues = job && draw_atlas == job->atlas &&
+        draw_first + draw_count == job->begin;
+      if (!continues) {
+        if (draw_count) {
+          quad_renderer_draw(renderer, draw_atlas, view_matrix, projection_matrix,
+                             draw_first, draw_count);
+        }
+        if (job) {
+          draw_atlas = job->atlas;
+          draw_first = job->begin;
+          draw_count = 0;
+        }
+      }
+      if (job) {
+        draw_count += job->write - job->begin;
+      }
+    }
+  }
+  quad_renderer_retire_instances(renderer);
   
   DEBUG_FUNCTION_END();
 }
@@ -15,8 +15,13 @@ typedef struct {
   v3 p;
 } Quad_Vertex;
 
+// NOTE(lvl5): everything is 2d, so a quad is the affine part of its model
+// matrix: where the unit x and y axes go, and where the origin goes.
+// z is dropped, draw order comes from the render item sort
 typedef struct {
-  mat4 model;
+  v2 x_axis;
+  v2 y_axis;
+  v2 p;
   u16 tex_x;
   u16 tex_y;
   u16 tex_width;
@@ -46,23 +51,7 @@ typedef struct {
 } Sprite;
 
 
-typedef struct {
-  Transform t;
-  v4 color;
-  
-  Transform d_t;
-  v4 d_color;
-  
-  f32 lifetime;
-} Particle;
-
-typedef struct {
-  Sprite sprite;
-  Particle *particles;
-  i32 particle_count;
-  i32 particle_capacity;
-} Particle_Emitter;
-
+#include "particle.h"
 
 
 typedef enum {
@@ -85,15 +74,21 @@ typedef struct {
   String text;
 } Render_Text;
 
+// NOTE(lvl5): items are drawn by layer, and inside a layer grouped by
+// atlas in the order the atlases first show up, so a layer costs one draw
+// per atlas. Submission order only holds between items of the same atlas,
+// anything that has to cover a different atlas goes on a higher layer
+#define RENDER_LAYER_COUNT 0x10000
+
 typedef struct {
   mat4 matrix;
   v4 color;
   Font *font;
+  i32 layer;
 } Render_State;
 
 typedef struct {
   Particle_Emitter *emitter;
-  f32 dt;
 } Render_Particle_Emitter;
 
 typedef struct {
@@ -132,12 +127,68 @@ typedef struct {
 } Render_Group;
 
 
+// NOTE(lvl5): a gl texture per atlas, uploaded when it's first drawn or
+// when the atlas changed since
+typedef struct {
+  Texture_Atlas *atlas;
+  byte *data;
+  i32 width;
+  i32 height;
+  u32 generation;
+  u32 texture;
+} Quad_Renderer_Texture;
+
+#define QUAD_RENDERER_MAX_TEXTURES 16
+
+// NOTE(lvl5): instances are written straight into one big vbo used as a
+// ring. With buffer storage (4.4) the ring stays mapped, and a fence per
+// segment keeps us off the quads the gpu hasn't drawn yet, which is only
+// ever a wait when it's a whole ring behind. Without it every group maps
+// its range unsynchronized, and the buffer is orphaned when the ring
+// wraps, so nothing in flight gets written over either way.
+// A group bigger than the whole ring goes through the arena and a plain
+// BufferData into instance_vbo
+#define QUAD_RENDERER_RING_SIZE megabytes(64)
+#define QUAD_RENDERER_RING_SEGMENTS 4
+#define QUAD_RENDERER_RING_ALIGN 64
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+typedef struct {
+  u32 vbo;
+  byte *persistent_data; // NOTE(lvl5): null when it maps per group
+  Mem_Size head;
+  i32 segment; // NOTE(lvl5): where head is, -1 after a wrap
+  GLsync fences[QUAD_RENDERER_RING_SEGMENTS];
+  
+  // NOTE(lvl5): what the group being drawn got
+  Mem_Size map_offset;
+  Mem_Size map_size;
+  Quad_Instance *overflow_instances;
+} Quad_Instance_Ring;
+
+typedef struct {
+  Texture_Atlas *atlas;
+  i32 first;
+  i32 count;
+} Quad_Batch;
+
 typedef struct {
   u32 vertex_vbo;
   u32 instance_vbo;
   u32 vao;
-  u32 texture;
   u32 shader;
+  
+  Quad_Instance_Ring ring;
+  
+  Quad_Renderer_Texture textures[QUAD_RENDERER_MAX_TEXTURES];
+  i32 texture_count;
+  i32 next_evicted_texture;
 } Quad_Renderer;
 
 
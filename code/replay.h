@@ -0,0 +1,231 @@
+#ifndef REPLAY_H
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+
+// NOTE(lvl5): replay files, shared by the platform layers.
+// Layout: Replay_Header, perm snapshot (perm_size bytes), then
+// frame_count frames of (f32 dt, Input delta). A file written with no perm
+// has perm_size 0 and only plays back with the caller's own copy of it.
+// Frames are streamed in and out, so a capture can be hours long. An
+// Input delta is the frame's Input xor'd with the previous one as runs of
+// (u16 zero_count, u16 literal_count, literal bytes) that add up to
+// sizeof(Input). A frame where nothing changed is 8 bytes.
+// Recordings start before the first game_update, so the snapshot is the
+// untouched perm block and playback goes through game init too. Nothing
+// in temp has to survive between runs that way
+
+#define REPLAY_MAGIC 0x31504c52 // "RLP1"
+#define REPLAY_VERSION 2
+// NOTE(lvl5): left in the header if the recorder never got to
+// replay_write_end, the reader then goes until the end of the file
+#define REPLAY_FRAME_COUNT_UNKNOWN 0xFFFFFFFF
+
+typedef struct {
+  u32 magic;
+  u32 version;
+  u32 input_size; // NOTE(lvl5): sizeof(Input) at record time, catches stale files
+  u32 frame_count;
+  u64 perm_size;
+  v2 window_size; // NOTE(lvl5): mouse to world depends on it
+} Replay_Header;
+
+typedef struct {
+  FILE *file;
+  u32 frame_count;
+  Input prev_input;
+} Replay_Writer;
+
+typedef struct {
+  FILE *file;
+  Replay_Header header;
+  u32 frame_index;
+  long frames_offset;
+  Input prev_input;
+} Replay_Reader;
+
+
+b32 replay_write_begin(Replay_Writer *w, char *path, byte *perm, Mem_Size perm_size,
+                        v2 window_size) {
+  b32 result = false;
+  w->file = fopen(path, "wb");
+  w->frame_count = 0;
+  zero_memory_slow(&w->prev_input, sizeof(Input));
+
+  if (w->file) {
+    Replay_Header header = {0};
+    header.magic = REPLAY_MAGIC;
+    header.version = REPLAY_VERSION;
+    header.input_size = sizeof(Input);
+    header.frame_count = REPLAY_FRAME_COUNT_UNKNOWN;
+    header.perm_size = perm ? perm_size : 0;
+    header.window_size = window_size;
+
+    result = fwrite(&header, sizeof(header), 1, w->file) == 1 &&
+      (!perm || fwrite(perm, perm_size, 1, w->file) == 1);
+  }
+
+  return result;
+}
+
+// NOTE(lvl5): one Input delta, at most REPLAY_INPUT_DELTA_MAX_SIZE bytes.
+// prev ends up as input. Rewind keeps its inputs the same way
+#define REPLAY_INPUT_DELTA_MAX_SIZE (3*sizeof(Input) + 2*sizeof(u16))
+
+Mem_Size replay_encode_input(byte *out, Input *input, Input *prev) {
+  byte *cur = (byte *)input;
+  byte *old = (byte *)prev;
+  byte *at_out = out;
+  u16 at = 0;
+
+  do {
+    u16 zero_count = 0;
+    while (at + zero_count < sizeof(Input) && cur[at + zero_count] == old[at + zero_count]) {
+      zero_count++;
+    }
+    at += zero_count;
+
+    byte *literals = at_out + 2*sizeof(u16);
+    u16 literal_count = 0;
+    while (at + literal_count < sizeof(Input) &&
+           cur[at + literal_count] != old[at + literal_count]) {
+      literals[literal_count] = cur[at + literal_count] ^ old[at + literal_count];
+      literal_count++;
+    }
+
+    memcpy(at_out, &zero_count, sizeof(zero_count));
+    memcpy(at_out + sizeof(u16), &literal_count, sizeof(literal_count));
+    at_out = literals + literal_count;
+    at += literal_count;
+  } while (at < sizeof(Input));
+
+  *prev = *input;
+  Mem_Size result = at_out - out;
+  return result;
+}
+
+// NOTE(lvl5): the other way around, for deltas that are known to be good.
+// prev ends up as the decoded input, returns the bytes read
+Mem_Size replay_decode_input(byte *in, Input *prev) {
+  byte *old = (byte *)prev;
+  byte *at_in = in;
+  u16 at = 0;
+
+  while (at < sizeof(Input)) {
+    u16 zero_count;
+    u16 literal_count;
+    memcpy(&zero_count, at_in, sizeof(zero_count));
+    memcpy(&literal_count, at_in + sizeof(u16), sizeof(literal_count));
+    at_in += 2*sizeof(u16);
+    assert(at + zero_count + literal_count <= sizeof(Input));
+
+    at += zero_count;
+    for (u16 literal_index = 0; literal_index < literal_count; literal_index++) {
+      old[at++] ^= *at_in++;
+    }
+  }
+
+  Mem_Size result = at_in - in;
+  return result;
+}
+
+void replay_write_frame(Replay_Writer *w, Input *input, f32 dt) {
+  byte delta[REPLAY_INPUT_DELTA_MAX_SIZE];
+  Mem_Size delta_size = replay_encode_input(delta, input, &w->prev_input);
+
+  fwrite(&dt, sizeof(dt), 1, w->file);
+  fwrite(delta, delta_size, 1, w->file);
+  w->frame_count++;
+}
+
+// NOTE(lvl5): the frame count goes into the header at the end,
+// so a recording can run for as long as it wants
+void replay_write_end(Replay_Writer *w) {
+  fseek(w->file, offsetof(Replay_Header, frame_count), SEEK_SET);
+  fwrite(&w->frame_count, sizeof(w->frame_count), 1, w->file);
+  fclose(w->file);
+  w->file = 0;
+}
+
+// NOTE(lvl5): the snapshot is read straight into perm, or skipped if it's
+// null. A file without one can only be read with a null perm
+b32 replay_read_begin(Replay_Reader *r, char *path, byte *perm, Mem_Size perm_size) {
+  b32 result = false;
+  r->file = fopen(path, "rb");
+  r->frame_index = 0;
+  zero_memory_slow(&r->prev_input, sizeof(Input));
+
+  if (r->file) {
+    Replay_Header *header = &r->header;
+    if (fread(header, sizeof(Replay_Header), 1, r->file) == 1 &&
+        header->magic == REPLAY_MAGIC &&
+        header->version == REPLAY_VERSION &&
+        header->input_size == sizeof(Input) &&
+        (header->perm_size == perm_size || header->perm_size == 0)) {
+      if (!header->perm_size) {
+        result = !perm;
+      } else if (perm) {
+        result = fread(perm, perm_size, 1, r->file) == 1;
+      } else {
+        result = fseek(r->file, (long)perm_size, SEEK_CUR) == 0;
+      }
+      r->frames_offset = ftell(r->file);
+    }
+  }
+
+  return result;
+}
+
+b32 replay_read_frame(Replay_Reader *r, Input *input, f32 *dt) {
+  b32 result = false;
+  if (r->frame_index < r->header.frame_count &&
+      fread(dt, sizeof(f32), 1, r->file) == 1) {
+    byte *prev = (byte *)&r->prev_input;
+    u16 at = 0;
+    result = true;
+
+    while (result && at < sizeof(Input)) {
+      u16 zero_count;
+      u16 literal_count;
+      result = fread(&zero_count, sizeof(zero_count), 1, r->file) == 1 &&
+        fread(&literal_count, sizeof(literal_count), 1, r->file) == 1 &&
+        (zero_count || literal_count) &&
+        at + zero_count + literal_count <= sizeof(Input);
+
+      if (result) {
+        at += zero_count;
+        for (u16 literal_index = 0; literal_index < literal_count; literal_index++) {
+          i32 ch = fgetc(r->file);
+          if (ch == EOF) {
+            result = false;
+            break;
+          }
+          prev[at++] ^= (byte)ch;
+        }
+      }
+    }
+
+    if (result) {
+      *input = r->prev_input;
+      r->frame_index++;
+    }
+  }
+  return result;
+}
+
+// NOTE(lvl5): back to the first frame, perm has to be restored by the caller
+void replay_read_rewind(Replay_Reader *r) {
+  fseek(r->file, r->frames_offset, SEEK_SET);
+  zero_memory_slow(&r->prev_input, sizeof(Input));
+  r->frame_index = 0;
+}
+
+void replay_read_end(Replay_Reader *r) {
+  if (r->file) {
+    fclose(r->file);
+  }
+  r->file = 0;
+}
+
+#define REPLAY_H
+#endif
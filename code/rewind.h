@@ -0,0 +1,353 @@
+#ifndef REWIND_H
+#include <stdlib.h>
+#include <string.h>
+#include "snapshot.h"
+#include "replay.h"
+
+// NOTE(lvl5): rewind buffer for perm, opt-in since it costs REWIND_BUDGET.
+// Every REWIND_KEYFRAME_INTERVAL frames the platform hands over perm at
+// the start of the frame. head holds the newest keyframe, and every
+// keyframe stores itself xor'd with the one before it as runs of
+// (u32 zero_words, u32 literal_words, literal u64s). Only the pages
+// written since the last keyframe are compared, same tracking as the
+// snapshots, and they're encoded one page at a time. Going from head back
+// to an older keyframe is xor-ing the deltas in from newest to oldest, so
+// the oldest keyframe's delta is never used and gets freed.
+// Every keyframe also keeps the frames after it as (f32 dt, Input delta),
+// the same Input encoding as the replay files, starting over from a zero
+// Input at each keyframe. Seeking to a frame is restoring the keyframe
+// before it and running game_simulate on those inputs up to that frame.
+// head, the deltas and the inputs all come out of REWIND_BUDGET. Old
+// keyframes are dropped when it's used up, or when they're more than
+// REWIND_FRAME_CAPACITY frames back
+
+#define REWIND_KEYFRAME_INTERVAL TARGET_FPS
+#define REWIND_FRAME_CAPACITY (TARGET_FPS*60*10)
+#define REWIND_KEYFRAME_CAPACITY (REWIND_FRAME_CAPACITY/REWIND_KEYFRAME_INTERVAL + 1)
+#define REWIND_BUDGET megabytes(256)
+
+// NOTE(lvl5): worst case every other word of the page changed
+#define REWIND_PAGE_DELTA_MAX_SIZE (SNAPSHOT_PAGE_SIZE + \
+(SNAPSHOT_PAGE_SIZE/sizeof(u64)/2 + 1)*2*sizeof(u32))
+#define REWIND_FRAME_MAX_SIZE (sizeof(f32) + REPLAY_INPUT_DELTA_MAX_SIZE)
+
+typedef struct {
+  u64 frame;
+  byte *delta; // NOTE(lvl5): null for the oldest one
+  Mem_Size delta_size;
+
+  byte *frames;
+  Mem_Size frames_size;
+  Mem_Size frames_capacity;
+  u32 frame_count;
+} Rewind_Keyframe;
+
+typedef struct {
+  Mem_Size perm_size;
+  u64 *head;
+  byte page_buffer[REWIND_PAGE_DELTA_MAX_SIZE];
+
+  byte **dirty_pages;
+  u64 page_count;
+  Snapshot_Get_Dirty_Pages *get_dirty_pages;
+
+  Rewind_Keyframe keyframes[REWIND_KEYFRAME_CAPACITY];
+  u32 first_keyframe;
+  u32 keyframe_count;
+
+  // NOTE(lvl5): what's left of REWIND_BUDGET after head, and how much of
+  // it the deltas and inputs take
+  Mem_Size budget;
+  Mem_Size used;
+
+  u64 frame; // NOTE(lvl5): the frame that is about to run
+  Input record_prev;
+
+  u64 resim_frame;
+  u64 resim_target_frame;
+  Mem_Size resim_offset;
+  Input resim_prev;
+} Rewind;
+
+
+// NOTE(lvl5): head starts as a copy of perm, the dirty page tracking has
+// to see every write to it from here on
+void rewind_init(Rewind *r, byte *perm, Mem_Size perm_size,
+                 Snapshot_Get_Dirty_Pages *get_dirty_pages) {
+  assert(perm_size % SNAPSHOT_PAGE_SIZE == 0);
+  zero_memory_slow(r, sizeof(Rewind));
+  r->perm_size = perm_size;
+  r->page_count = perm_size/SNAPSHOT_PAGE_SIZE;
+  r->dirty_pages = (byte **)malloc(sizeof(byte *)*r->page_count);
+  r->get_dirty_pages = get_dirty_pages;
+  r->head = (u64 *)malloc(perm_size);
+  memcpy(r->head, perm, perm_size);
+  r->get_dirty_pages(perm, r->perm_size, r->dirty_pages, r->page_count);
+
+  Mem_Size overhead = perm_size + sizeof(byte *)*r->page_count + sizeof(Rewind);
+  assert(overhead < REWIND_BUDGET);
+  r->budget = REWIND_BUDGET - overhead;
+}
+
+Rewind_Keyframe *rewind_get_keyframe(Rewind *r, u32 index) {
+  Rewind_Keyframe *result = r->keyframes +
+    (r->first_keyframe + index) % array_count(r->keyframes);
+  return result;
+}
+
+void rewind_free_delta(Rewind *r, Rewind_Keyframe *k) {
+  r->used -= k->delta_size;
+  free(k->delta);
+  k->delta = 0;
+  k->delta_size = 0;
+}
+
+void rewind_free_keyframe(Rewind *r, Rewind_Keyframe *k) {
+  rewind_free_delta(r, k);
+  r->used -= k->frames_capacity;
+  free(k->frames);
+  k->frames = 0;
+  k->frames_size = 0;
+  k->frames_capacity = 0;
+  k->frame_count = 0;
+}
+
+void rewind_drop_oldest_keyframe(Rewind *r) {
+  assert(r->keyframe_count);
+  rewind_free_keyframe(r, rewind_get_keyframe(r, 0));
+  r->first_keyframe = (r->first_keyframe + 1) % array_count(r->keyframes);
+  r->keyframe_count--;
+
+  // NOTE(lvl5): nothing is older than it now, so its delta can't be used
+  if (r->keyframe_count) {
+    rewind_free_delta(r, rewind_get_keyframe(r, 0));
+  }
+}
+
+void rewind_drop_newest_keyframe(Rewind *r) {
+  assert(r->keyframe_count);
+  rewind_free_keyframe(r, rewind_get_keyframe(r, r->keyframe_count - 1));
+  r->keyframe_count--;
+}
+
+// NOTE(lvl5): writes the runs of perm^head for one page into page_buffer
+// and makes that page of head = perm. run_end is where the last run
+// ended, pages come in address order so it carries over
+Mem_Size rewind_encode_page(Rewind *r, u64 *perm, u64 at, u64 *run_end) {
+  u64 end = at + SNAPSHOT_PAGE_SIZE/sizeof(u64);
+  u64 *head = r->head;
+  byte *out = r->page_buffer;
+  assert(at >= *run_end);
+
+  while (at < end) {
+    if (perm[at] == head[at]) {
+      at++;
+      continue;
+    }
+
+    assert(at - *run_end <= 0xFFFFFFFF);
+    u32 *literal_words = (u32 *)(out + sizeof(u32));
+    *(u32 *)out = (u32)(at - *run_end);
+    *literal_words = 0;
+    out += 2*sizeof(u32);
+
+    while (at < end && perm[at] != head[at]) {
+      u64 x = perm[at] ^ head[at];
+      memcpy(out, &x, sizeof(u64));
+      out += sizeof(u64);
+      head[at] = perm[at];
+      (*literal_words)++;
+      at++;
+    }
+    *run_end = at;
+  }
+
+  Mem_Size result = out - r->page_buffer;
+  assert(result <= sizeof(r->page_buffer));
+  return result;
+}
+
+// NOTE(lvl5): makes head = perm, and keeps the delta in k unless
+// keep_delta is false, head still has to move then
+void rewind_encode_keyframe(Rewind *r, Rewind_Keyframe *k, u64 *perm, b32 keep_delta) {
+  // NOTE(lvl5): -1 means no tracking, then every page gets compared
+  i64 dirty_count = r->get_dirty_pages((byte *)perm, r->perm_size,
+                                       r->dirty_pages, r->page_count);
+  i64 page_count = dirty_count < 0 ? (i64)r->page_count : dirty_count;
+  u64 run_end = 0;
+  Mem_Size capacity = 0;
+
+  for (i64 page_index = 0; page_index < page_count; page_index++) {
+    byte *page = dirty_count < 0 ? (byte *)perm + page_index*SNAPSHOT_PAGE_SIZE :
+      r->dirty_pages[page_index];
+    u64 at = (u64)(page - (byte *)perm)/sizeof(u64);
+    Mem_Size page_size = rewind_encode_page(r, perm, at, &run_end);
+
+    if (keep_delta && page_size) {
+      if (k->delta_size + page_size > capacity) {
+        capacity = capacity ? capacity*2 : kilobytes(64);
+        k->delta = (byte *)realloc(k->delta, capacity);
+      }
+      memcpy(k->delta + k->delta_size, r->page_buffer, page_size);
+      k->delta_size += page_size;
+    }
+  }
+
+  if (k->delta_size < capacity) {
+    k->delta = (byte *)realloc(k->delta, k->delta_size);
+  }
+  r->used += k->delta_size;
+}
+
+void rewind_apply_delta(u64 *dst, u64 word_count, byte *delta, Mem_Size delta_size) {
+  byte *at = delta;
+  u64 word = 0;
+  while (at < delta + delta_size) {
+    u32 zero_words = *(u32 *)at;
+    u32 literal_words = *(u32 *)(at + sizeof(u32));
+    at += 2*sizeof(u32);
+    word += zero_words;
+
+    assert(word + literal_words <= word_count);
+    for (u32 literal_index = 0; literal_index < literal_words; literal_index++) {
+      u64 x;
+      memcpy(&x, at, sizeof(u64));
+      dst[word++] ^= x;
+      at += sizeof(u64);
+    }
+  }
+}
+
+// NOTE(lvl5): reads the frame at offset in k->frames, prev goes along
+// with it. Returns the offset of the next one
+Mem_Size rewind_decode_frame(Rewind_Keyframe *k, Mem_Size offset, Input *prev, f32 *dt) {
+  assert(offset < k->frames_size);
+  memcpy(dt, k->frames + offset, sizeof(f32));
+  offset += sizeof(f32);
+  offset += replay_decode_input(k->frames + offset, prev);
+  return offset;
+}
+
+// NOTE(lvl5): call before game_update with the input it's going to get
+void rewind_record_frame(Rewind *r, byte *perm, Input *input, f32 dt) {
+  // NOTE(lvl5): after a seek to a keyframe it's already there
+  b32 has_keyframe = r->keyframe_count &&
+    rewind_get_keyframe(r, r->keyframe_count - 1)->frame == r->frame;
+  if ((r->frame % REWIND_KEYFRAME_INTERVAL == 0 || !r->keyframe_count) &&
+      !has_keyframe) {
+    if (r->keyframe_count == array_count(r->keyframes)) {
+      rewind_drop_oldest_keyframe(r);
+    }
+
+    Rewind_Keyframe *k = rewind_get_keyframe(r, r->keyframe_count++);
+    zero_memory_slow(k, sizeof(Rewind_Keyframe));
+    k->frame = r->frame;
+    rewind_encode_keyframe(r, k, (u64 *)perm, r->keyframe_count > 1);
+    zero_memory_slow(&r->record_prev, sizeof(Input));
+  }
+
+  Rewind_Keyframe *k = rewind_get_keyframe(r, r->keyframe_count - 1);
+  assert(k->frame + k->frame_count == r->frame);
+  if (k->frames_size + REWIND_FRAME_MAX_SIZE > k->frames_capacity) {
+    Mem_Size capacity = k->frames_capacity ? k->frames_capacity*2 : kilobytes(1);
+    k->frames = (byte *)realloc(k->frames, capacity);
+    r->used += capacity - k->frames_capacity;
+    k->frames_capacity = capacity;
+  }
+  memcpy(k->frames + k->frames_size, &dt, sizeof(f32));
+  k->frames_size += sizeof(f32);
+  k->frames_size += replay_encode_input(k->frames + k->frames_size, input, &r->record_prev);
+  k->frame_count++;
+  r->frame++;
+
+  // NOTE(lvl5): the newest keyframe is head itself, it always stays
+  while (r->keyframe_count > 1 &&
+         (r->used > r->budget ||
+          r->frame - rewind_get_keyframe(r, 0)->frame > REWIND_FRAME_CAPACITY)) {
+    rewind_drop_oldest_keyframe(r);
+  }
+}
+
+// NOTE(lvl5): for when perm jumps without going through the frames, like
+// loading a save point. Recording starts over from the next frame
+void rewind_clear(Rewind *r) {
+  while (r->keyframe_count) {
+    rewind_drop_newest_keyframe(r);
+  }
+}
+
+u64 rewind_get_oldest_frame(Rewind *r) {
+  u64 result = r->keyframe_count ? rewind_get_keyframe(r, 0)->frame : r->frame;
+  return result;
+}
+
+// NOTE(lvl5): restores perm to the last keyframe at or before frame, and
+// forgets everything after it. The frames up to the target then come out
+// of rewind_next_resim_frame
+void rewind_seek(Rewind *r, byte *perm, u64 frame) {
+  assert(r->keyframe_count);
+  if (frame < rewind_get_oldest_frame(r)) frame = rewind_get_oldest_frame(r);
+  if (frame > r->frame) frame = r->frame;
+
+  // NOTE(lvl5): back to head first, only the pages written since it can
+  // be different. Then the deltas go into both, so perm only gets written
+  // where it changes
+  i64 dirty_count = r->get_dirty_pages(perm, r->perm_size,
+                                       r->dirty_pages, r->page_count);
+  b32 is_tracked = dirty_count >= 0;
+  if (is_tracked) {
+    for (i64 dirty_index = 0; dirty_index < dirty_count; dirty_index++) {
+      byte *page = r->dirty_pages[dirty_index];
+      memcpy(page, (byte *)r->head + (page - perm), SNAPSHOT_PAGE_SIZE);
+    }
+  }
+
+  u64 word_count = r->perm_size/sizeof(u64);
+  Rewind_Keyframe *newest = rewind_get_keyframe(r, r->keyframe_count - 1);
+  while (newest->frame > frame) {
+    rewind_apply_delta(r->head, word_count, newest->delta, newest->delta_size);
+    if (is_tracked) {
+      rewind_apply_delta((u64 *)perm, word_count, newest->delta, newest->delta_size);
+    }
+    rewind_drop_newest_keyframe(r);
+    newest = rewind_get_keyframe(r, r->keyframe_count - 1);
+  }
+
+  if (!is_tracked) {
+    memcpy(perm, r->head, r->perm_size);
+  }
+
+  // NOTE(lvl5): the inputs after the target go, recording picks up from
+  // there with the last kept input as prev
+  u32 kept_count = (u32)(frame - newest->frame);
+  assert(kept_count <= newest->frame_count);
+  Mem_Size offset = 0;
+  zero_memory_slow(&r->record_prev, sizeof(Input));
+  for (u32 frame_index = 0; frame_index < kept_count; frame_index++) {
+    f32 dt;
+    offset = rewind_decode_frame(newest, offset, &r->record_prev, &dt);
+  }
+  newest->frames_size = offset;
+  newest->frame_count = kept_count;
+
+  r->resim_frame = newest->frame;
+  r->resim_target_frame = frame;
+  r->resim_offset = 0;
+  zero_memory_slow(&r->resim_prev, sizeof(Input));
+  r->frame = frame;
+}
+
+b32 rewind_next_resim_frame(Rewind *r, Input *input, f32 *dt) {
+  b32 result = false;
+  if (r->resim_frame < r->resim_target_frame) {
+    Rewind_Keyframe *k = rewind_get_keyframe(r, r->keyframe_count - 1);
+    r->resim_offset = rewind_decode_frame(k, r->resim_offset, &r->resim_prev, dt);
+    *input = r->resim_prev;
+    r->resim_frame++;
+    result = true;
+  }
+  return result;
+}
+
+#define REWIND_H
+#endif
@@ -0,0 +1,160 @@
+#ifndef SNAPSHOT_H
+#include <stdlib.h>
+#include <string.h>
+
+// NOTE(lvl5): incremental snapshots of a block of memory, used on perm.
+// The copy is kept equal to the memory except on the pages written since
+// the last save or restore, which the platform tracks (write watch,
+// soft-dirty). Save and restore only move those pages. Pages nobody ever
+// touched, like most of misc_entity_storages, stay zero on both sides and
+// never get copied.
+// The tracking is reset by every save and restore, so with more than one
+// user of the same memory they have to go through a Snapshot_Tracker.
+// Either way it has to be set up before anything writes to the memory.
+
+#define SNAPSHOT_PAGE_SIZE kilobytes(4)
+
+// NOTE(lvl5): fills pages with the addresses of pages written since the last
+// call and resets the tracking. -1 means tracking doesn't work, everything
+// gets copied then
+#define SNAPSHOT_GET_DIRTY_PAGES(name) i64 name(byte *memory, Mem_Size size, \
+byte **pages, u64 page_capacity)
+typedef SNAPSHOT_GET_DIRTY_PAGES(Snapshot_Get_Dirty_Pages);
+
+typedef struct {
+  byte *memory;
+  Mem_Size size;
+  byte *copy;
+
+  byte **dirty_pages;
+  u64 page_count;
+  u64 last_page_count; // NOTE(lvl5): how much the last save/restore moved
+
+  Snapshot_Get_Dirty_Pages *get_dirty_pages;
+} Snapshot;
+
+
+// NOTE(lvl5): copy has to be zeroed, like the memory is
+void snapshot_init(Snapshot *s, byte *memory, Mem_Size size, byte *copy,
+                   Snapshot_Get_Dirty_Pages *get_dirty_pages) {
+  assert(size % SNAPSHOT_PAGE_SIZE == 0);
+  s->memory = memory;
+  s->size = size;
+  s->copy = copy;
+  s->page_count = size/SNAPSHOT_PAGE_SIZE;
+  s->dirty_pages = (byte **)malloc(sizeof(byte *)*s->page_count);
+  s->get_dirty_pages = get_dirty_pages;
+  s->last_page_count = 0;
+
+  s->get_dirty_pages(s->memory, s->size, s->dirty_pages, s->page_count);
+}
+
+void snapshot_sync(Snapshot *s, b32 is_save) {
+  i64 dirty_count = s->get_dirty_pages(s->memory, s->size,
+                                       s->dirty_pages, s->page_count);
+  if (dirty_count < 0) {
+    if (is_save) {
+      copy_memory_slow(s->copy, s->memory, s->size);
+    } else {
+      copy_memory_slow(s->memory, s->copy, s->size);
+    }
+    s->last_page_count = s->page_count;
+  } else {
+    for (i64 dirty_index = 0; dirty_index < dirty_count; dirty_index++) {
+      byte *page = s->dirty_pages[dirty_index];
+      byte *copy_page = s->copy + (page - s->memory);
+      if (is_save) {
+        memcpy(copy_page, page, SNAPSHOT_PAGE_SIZE);
+      } else {
+        memcpy(page, copy_page, SNAPSHOT_PAGE_SIZE);
+      }
+    }
+    s->last_page_count = (u64)dirty_count;
+  }
+
+  // NOTE(lvl5): restoring wrote to the pages again, they match the copy
+  // now so that doesn't count
+  if (!is_save) {
+    s->get_dirty_pages(s->memory, s->size, s->dirty_pages, s->page_count);
+  }
+}
+
+// NOTE(lvl5): the platform trackers reset for everyone on every query,
+// write watch has one reset and clear_refs is for the whole process. The
+// snapshots and rewind each want the pages written since they last asked,
+// so the platform drains its tracker into a flag per page for every user
+// and gives each one a SNAPSHOT_GET_DIRTY_PAGES that calls
+// snapshot_tracker_take with its own index
+#define SNAPSHOT_TRACKER_MAX_USERS 4
+
+typedef struct {
+  byte *memory;
+  Mem_Size size;
+  u64 page_count;
+  Snapshot_Get_Dirty_Pages *get_dirty_pages;
+
+  byte **written_pages;
+  u8 *is_dirty[SNAPSHOT_TRACKER_MAX_USERS];
+  b32 is_tracked; // NOTE(lvl5): false once the platform tracker returned -1
+} Snapshot_Tracker;
+
+
+void snapshot_tracker_init(Snapshot_Tracker *t, byte *memory, Mem_Size size,
+                           Snapshot_Get_Dirty_Pages *get_dirty_pages) {
+  assert(size % SNAPSHOT_PAGE_SIZE == 0);
+  t->memory = memory;
+  t->size = size;
+  t->page_count = size/SNAPSHOT_PAGE_SIZE;
+  t->get_dirty_pages = get_dirty_pages;
+  t->written_pages = (byte **)malloc(sizeof(byte *)*t->page_count);
+  for (i32 user = 0; user < SNAPSHOT_TRACKER_MAX_USERS; user++) {
+    t->is_dirty[user] = (u8 *)calloc(t->page_count, 1);
+  }
+  t->is_tracked = true;
+
+  t->get_dirty_pages(t->memory, t->size, t->written_pages, t->page_count);
+}
+
+// NOTE(lvl5): the pages user hasn't seen yet, in address order
+i64 snapshot_tracker_take(Snapshot_Tracker *t, i32 user, byte *memory, Mem_Size size,
+                          byte **pages, u64 page_capacity) {
+  assert(user < SNAPSHOT_TRACKER_MAX_USERS);
+  assert(memory == t->memory && size == t->size && page_capacity >= t->page_count);
+
+  i64 written_count = -1;
+  if (t->is_tracked) {
+    written_count = t->get_dirty_pages(t->memory, t->size, t->written_pages, t->page_count);
+    t->is_tracked = written_count >= 0;
+  }
+
+  i64 result = -1;
+  if (t->is_tracked) {
+    for (i64 written_index = 0; written_index < written_count; written_index++) {
+      u64 page_index = (t->written_pages[written_index] - t->memory)/SNAPSHOT_PAGE_SIZE;
+      for (i32 other = 0; other < SNAPSHOT_TRACKER_MAX_USERS; other++) {
+        t->is_dirty[other][page_index] = true;
+      }
+    }
+
+    result = 0;
+    u8 *is_dirty = t->is_dirty[user];
+    for (u64 page_index = 0; page_index < t->page_count; page_index++) {
+      if (is_dirty[page_index]) {
+        is_dirty[page_index] = false;
+        pages[result++] = t->memory + page_index*SNAPSHOT_PAGE_SIZE;
+      }
+    }
+  }
+  return result;
+}
+
+void snapshot_save(Snapshot *s) {
+  snapshot_sync(s, true);
+}
+
+void snapshot_restore(Snapshot *s) {
+  snapshot_sync(s, false);
+}
+
+#define SNAPSHOT_H
+#endif
@@ -14,8 +14,13 @@
 #include "lvl5_opengl_win32.h"
 
 #define TARGET_FPS 60
+#define MAX_FRAME_DT 0.25f
 #include "lvl5_context.h"
 
+#include "replay.h"
+#include "snapshot.h"
+#include "rewind.h"
+
 
 
 typedef struct {
@@ -33,16 +38,24 @@ typedef enum {
   Replay_State_PLAY,
 } Replay_State;
 
+// NOTE(lvl5): inputs are streamed to a replay file, so a loop can be
+// as long as it wants. snapshot keeps perm for restarting the loop
 typedef struct {
   Replay_State state;
   
-  byte *data;
-  Input inputs[TARGET_FPS*60];
-  i32 count;
-  i32 play_index;
+  Snapshot snapshot;
+  char path[MAX_PATH];
+  Replay_Writer writer;
+  Replay_Reader reader;
 } win32_Replay;
 
 
+// NOTE(lvl5): the snapshot and rewind both watch perm
+typedef enum {
+  win32_Dirty_User_SNAPSHOT,
+  win32_Dirty_User_REWIND,
+} win32_Dirty_User;
+
 typedef struct {
   b32 window_resized;
   u64 performance_frequency;
@@ -52,6 +65,14 @@ typedef struct {
   Sound_Buffer game_sound_buffer;
   
   win32_Replay replay;
+  
+  // NOTE(lvl5): F3 goes back a second, as long as no replay is running.
+  // Only with --rewind on the command line
+  b32 rewind_enabled;
+  Rewind rewind;
+  b32 rewind_requested;
+  
+  Snapshot_Tracker dirty_pages;
 } win32_State;
 
 win32_State state;
@@ -74,38 +95,76 @@ u64 win32_get_last_write_time(String file_name) {
   return result;
 }
 
-void win32_replay_begin_write(Memory memory) {
+SNAPSHOT_GET_DIRTY_PAGES(win32_get_dirty_pages) {
+  i64 result = -1;
+  ULONG_PTR count = page_capacity;
+  ULONG granularity;
+  if (GetWriteWatch(WRITE_WATCH_FLAG_RESET, memory, size,
+                    (PVOID *)pages, &count, &granularity) == 0 &&
+      granularity == SNAPSHOT_PAGE_SIZE) {
+    result = (i64)count;
+  }
+  return result;
+}
+
+SNAPSHOT_GET_DIRTY_PAGES(win32_get_snapshot_dirty_pages) {
+  i64 result = snapshot_tracker_take(&state.dirty_pages, win32_Dirty_User_SNAPSHOT,
+                                     memory, size, pages, page_capacity);
+  return result;
+}
+
+SNAPSHOT_GET_DIRTY_PAGES(win32_get_rewind_dirty_pages) {
+  i64 result = snapshot_tracker_take(&state.dirty_pages, win32_Dirty_User_REWIND,
+                                     memory, size, pages, page_capacity);
+  return result;
+}
+
+void win32_replay_begin_write(Memory memory, v2 window_size) {
   win32_Replay *r = &state.replay;
   assert(r->state == Replay_State_NONE);
-  r->state = Replay_State_WRITE;
-  copy_memory_slow(r->data, memory.perm, memory.perm_size);
-  r->count = 0;
+  // NOTE(lvl5): the loop restarts from the snapshot, so the file only
+  // needs the inputs
+  if (replay_write_begin(&r->writer, r->path, 0, memory.perm_size,
+                         window_size)) {
+    r->state = Replay_State_WRITE;
+    snapshot_save(&r->snapshot);
+  }
 }
 
 void win32_replay_begin_play(Memory memory) {
   win32_Replay *r = &state.replay;
-  r->state = Replay_State_PLAY;
-  r->play_index = 0;
-  copy_memory_slow(memory.perm, r->data, memory.perm_size);
+  if (r->state == Replay_State_WRITE) {
+    u32 frame_count = r->writer.frame_count;
+    replay_write_end(&r->writer);
+    r->state = Replay_State_NONE;
+    
+    if (frame_count &&
+        replay_read_begin(&r->reader, r->path, 0, memory.perm_size)) {
+      r->state = Replay_State_PLAY;
+    }
+  } else {
+    replay_read_rewind(&r->reader);
+  }
+  
+  if (r->state == Replay_State_PLAY) {
+    snapshot_restore(&r->snapshot);
+  }
 }
 
-void win32_replay_save_input(Input input, Memory memory) {
+void win32_replay_save_input(Input input, f32 dt, Memory memory) {
   win32_Replay *r = &state.replay;
   assert(r->state == Replay_State_WRITE);
-  
-  r->inputs[r->count++] = input;
-  if (r->count == array_count(r->inputs)) {
-    win32_replay_begin_play(memory);
-  }
+  replay_write_frame(&r->writer, &input, dt);
 }
 
-Input win32_replay_get_next_input(Memory memory) {
+Input win32_replay_get_next_input(Memory memory, f32 *dt) {
   win32_Replay *r = &state.replay;
   assert(r->state == Replay_State_PLAY);
-  assert(r->play_index < r->count);
-  Input result = r->inputs[r->play_index++];
-  if (r->play_index == r->count) {
+  Input result;
+  if (!replay_read_frame(&r->reader, &result, dt)) {
     win32_replay_begin_play(memory);
+    b32 success = replay_read_frame(&r->reader, &result, dt);
+    assert(success);
   }
   return result;
 }
@@ -402,6 +461,45 @@ void win32_fill_audio_buffer(win32_Sound *win32_sound, Sound_Buffer *src_buffer)
 }
 
 
+// NOTE(lvl5): some drivers hand out 1, 2, 3 or -1 instead of null
+void *win32_get_gl_proc(char *name) {
+  void *result = (void *)wglGetProcAddress(name);
+  if (result == (void *)1 || result == (void *)2 || result == (void *)3 ||
+      result == (void *)-1) {
+    result = 0;
+  }
+  return result;
+}
+
+// NOTE(lvl5): the instance ring's entry points, lvl5_opengl_win32 doesn't
+// load them. Like on linux, the 4.4 ones stay null without a 4.4 context,
+// and the renderer checks all of them for null
+void win32_load_gl_ring_funcs() {
+#define WIN32_LOAD_GL_FUNC(name) \
+  *(void **)&gl.name = win32_get_gl_proc("gl" #name);
+
+  WIN32_LOAD_GL_FUNC(MapBufferRange);
+  WIN32_LOAD_GL_FUNC(UnmapBuffer);
+
+  GLint major = 0;
+  GLint minor = 0;
+  glGetIntegerv(0x821B, &major); // NOTE(lvl5): GL_MAJOR_VERSION
+  glGetIntegerv(0x821C, &minor); // NOTE(lvl5): GL_MINOR_VERSION
+  if (major > 4 || (major == 4 && minor >= 4)) {
+    WIN32_LOAD_GL_FUNC(BufferStorage);
+    WIN32_LOAD_GL_FUNC(FenceSync);
+    WIN32_LOAD_GL_FUNC(ClientWaitSync);
+    WIN32_LOAD_GL_FUNC(DeleteSync);
+  } else {
+    gl.BufferStorage = 0;
+    gl.FenceSync = 0;
+    gl.ClientWaitSync = 0;
+    gl.DeleteSync = 0;
+  }
+
+#undef WIN32_LOAD_GL_FUNC
+}
+
 f64 win32_get_time() {
   LARGE_INTEGER time_li;
   QueryPerformanceCounter(&time_li);
@@ -508,7 +606,9 @@ ALLOCATOR(system_allocator) {
 typedef struct {
   volatile i32 write_cursor;
   volatile i32 read_cursor;
-  Work_Queue_Entry entries[32];
+  volatile i32 completion_goal;
+  volatile i32 completion_count;
+  Work_Queue_Entry entries[256];
   HANDLE semaphore;
 } win32_Work_Queue;
 
@@ -524,6 +624,7 @@ PLATFORM_ADD_WORK_QUEUE_ENTRY(win32_add_queue_entry) {
   Work_Queue_Entry *entry = queue->entries + queue->write_cursor;
   entry->fn = fn;
   entry->data = data;
+  queue->completion_goal++;
   
   complete_past_writes_before_future_writes();
   i32 new_write_cursor = (queue->write_cursor + 1) % array_count(queue->entries);
@@ -546,6 +647,7 @@ b32 win32_do_next_queue_entry(win32_Work_Queue *queue) {
     if (index == original_read_cursor) {
       Work_Queue_Entry *entry = queue->entries + index;
       entry->fn(entry->data);
+      InterlockedIncrement((volatile LONG *)&queue->completion_count);
     }
   } else {
     result = false;
@@ -554,6 +656,17 @@ b32 win32_do_next_queue_entry(win32_Work_Queue *queue) {
   return result;
 }
 
+PLATFORM_COMPLETE_ALL_WORK(win32_complete_all_work) {
+  win32_Work_Queue *queue = (win32_Work_Queue *)queue_ptr;
+  
+  while (queue->completion_count != queue->completion_goal) {
+    win32_do_next_queue_entry(queue);
+  }
+  
+  queue->completion_goal = 0;
+  queue->completion_count = 0;
+}
+
 DWORD WINAPI ThreadProc(void *data) {
   win32_Thread_Info *info = (win32_Thread_Info *)data;
   win32_Work_Queue *queue = info->queue;
@@ -616,6 +729,7 @@ int CALLBACK WinMain(HINSTANCE instance,
   
   // NOTE(lvl5): init openGL
   HWND window = win32_init_opengl(instance, WindowProc);
+  win32_load_gl_ring_funcs();
   
   // NOTE(lvl5): init sound
   {
@@ -639,7 +753,7 @@ int CALLBACK WinMain(HINSTANCE instance,
   
   HDC device_context = GetDC(window);
   
-  Memory game_memory;
+  Memory game_memory = {0};
   game_memory.global_context_info = global_context_info;
   game_memory.perm_size = megabytes(64);
   game_memory.temp_size = gigabytes(1);
@@ -647,7 +761,7 @@ int CALLBACK WinMain(HINSTANCE instance,
   Mem_Size total_size = game_memory.perm_size + game_memory.temp_size + game_memory.debug_size;
   byte *total_memory = (byte *)VirtualAlloc((void *)terabytes(2),
                                             total_size,
-                                            MEM_COMMIT|MEM_RESERVE,
+                                            MEM_COMMIT|MEM_RESERVE|MEM_WRITE_WATCH,
                                             PAGE_READWRITE);
   assert(total_memory);
   
@@ -655,14 +769,27 @@ int CALLBACK WinMain(HINSTANCE instance,
   game_memory.temp = game_memory.perm + game_memory.perm_size;
   game_memory.debug = game_memory.temp + game_memory.temp_size;
   
-  zero_memory_slow(total_memory, game_memory.perm_size);
-  
-  state.replay.data = malloc(game_memory.perm_size);
+  // NOTE(lvl5): VirtualAlloc memory is already zero. Touching it here
+  // would mark every perm page as written for the snapshot
+  byte *snapshot_copy = (byte *)VirtualAlloc(0, game_memory.perm_size,
+                                             MEM_COMMIT|MEM_RESERVE,
+                                             PAGE_READWRITE);
+  snapshot_tracker_init(&state.dirty_pages, game_memory.perm, game_memory.perm_size,
+                        win32_get_dirty_pages);
+  snapshot_init(&state.replay.snapshot, game_memory.perm, game_memory.perm_size,
+                snapshot_copy, win32_get_snapshot_dirty_pages);
+  state.rewind_enabled = strstr(commandLine, "--rewind") != 0;
+  if (state.rewind_enabled) {
+    rewind_init(&state.rewind, game_memory.perm, game_memory.perm_size,
+                win32_get_rewind_dirty_pages);
+  }
+  sprintf_s(state.replay.path, array_count(state.replay.path), "%s",
+            to_c_string(concat(win32_get_build_dir(), const_string("loop.rpl"))));
   
   Input game_input = {0};
   
   state.running = true;
-  state.dt = 0;
+  state.dt = 1.0f/TARGET_FPS;
   
   f64 last_time = win32_get_time();
   u64 last_cycles = __rdtsc();
@@ -678,11 +805,16 @@ int CALLBACK WinMain(HINSTANCE instance,
   platform.read_file = win32_read_file;
   platform.close_file = win32_close_file;
   platform.add_work_queue_entry = win32_add_queue_entry;
+  platform.complete_all_work = win32_complete_all_work;
   platform.high_queue = (Work_Queue)&high_queue;
   
   HMODULE game_lib = 0;
   Game_Update *game_update = 0;
+  Game_Simulate *game_simulate = 0;
   u64 last_game_dll_write_time = 0;
+  // NOTE(lvl5): rewind starts after the frame that initialized the game,
+  // game_simulate can't do that part
+  b32 game_has_run = false;
   
   MSG message;
   while (state.running) {
@@ -718,6 +850,8 @@ int CALLBACK WinMain(HINSTANCE instance,
         assert(game_lib);
         game_update = (Game_Update *)GetProcAddress(game_lib, "game_update");
         assert(game_update);
+        game_simulate = (Game_Simulate *)GetProcAddress(game_lib, "game_simulate");
+        assert(game_simulate);
         
         last_game_dll_write_time = current_write_time;
         game_memory.is_reloaded = true;
@@ -868,12 +1002,16 @@ int CALLBACK WinMain(HINSTANCE instance,
             break;
             case VK_F1:
             if (key_went_down && state.replay.state == Replay_State_NONE)
-              win32_replay_begin_write(game_memory);
+              win32_replay_begin_write(game_memory, game_screen);
             break;
             case VK_F2:
             if (key_went_down && state.replay.state == Replay_State_WRITE)
               win32_replay_begin_play(game_memory);
             break;
+            case VK_F3:
+            if (key_went_down)
+              state.rewind_requested = true;
+            break;
           }
         } break;
         
@@ -886,12 +1024,31 @@ int CALLBACK WinMain(HINSTANCE instance,
     }
     
     if (state.replay.state == Replay_State_WRITE) {
-      win32_replay_save_input(game_input, game_memory);
+      win32_replay_save_input(game_input, state.dt, game_memory);
     } else if (state.replay.state == Replay_State_PLAY) {
-      game_input = win32_replay_get_next_input(game_memory);
+      game_input = win32_replay_get_next_input(game_memory, &state.dt);
+    } else if (state.rewind_enabled && game_has_run) {
+      if (state.rewind_requested && state.rewind.keyframe_count) {
+        Rewind *r = &state.rewind;
+        u64 target_frame = r->frame > TARGET_FPS ? r->frame - TARGET_FPS : 0;
+        rewind_seek(r, game_memory.perm, target_frame);
+        
+        Memory resim_memory = game_memory;
+        resim_memory.window_resized = false;
+        Input resim_input;
+        f32 resim_dt;
+        while (rewind_next_resim_frame(r, &resim_input, &resim_dt)) {
+          game_simulate(game_screen, resim_memory, &resim_input, resim_dt, platform);
+          resim_memory.is_reloaded = false;
+        }
+        game_memory.is_reloaded = resim_memory.is_reloaded;
+      }
+      rewind_record_frame(&state.rewind, game_memory.perm, &game_input, state.dt);
     }
+    state.rewind_requested = false;
     
     game_update(game_screen, game_memory, &game_input, state.dt, platform);
+    game_has_run = true;
     
     if (state.game_sound_buffer.count) {
       win32_fill_audio_buffer(&state.sound, &state.game_sound_buffer);
@@ -901,8 +1058,12 @@ int CALLBACK WinMain(HINSTANCE instance,
     f64 current_time = win32_get_time();
     f32 time_used = (f32)(current_time - time_frame_start);
     
-    //state.dt = (f32)(current_time - last_time);
-    state.dt = 1.0f/TARGET_FPS;
+    // NOTE(lvl5): the game runs a fixed step simulation, so it gets the real
+    // frame time. Clamp it so a breakpoint doesn't become a huge step
+    state.dt = (f32)(current_time - last_time);
+    if (state.dt > MAX_FRAME_DT) {
+      state.dt = MAX_FRAME_DT;
+    }
     
     
     u64 current_cycles = __rdtsc();
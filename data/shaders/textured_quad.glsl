@@ -3,9 +3,10 @@
 
 layout (location = 0) in vec3 v_pos;
 
-layout (location = 1) in mat4x4 inst_model;
-layout (location = 5) in vec4 inst_tex;
-layout (location = 6) in vec4 inst_color;
+layout (location = 1) in vec4 inst_axes; // x axis in xy, y axis in zw
+layout (location = 2) in vec2 inst_p;
+layout (location = 3) in vec4 inst_tex;
+layout (location = 4) in vec4 inst_color;
 
 out vec2 fr_tex_coord;
 out vec4 fr_color;
@@ -15,8 +16,8 @@ uniform mat4x4 u_projection;
 uniform sampler2D texture_image;
 
 void main() {
-  mat4x4 u_model = transpose(inst_model);
-  vec4 p = u_projection*u_view*u_model*vec4(v_pos, 1.0f);
+  vec2 world_p = inst_axes.xy*v_pos.x + inst_axes.zw*v_pos.y + inst_p;
+  vec4 p = u_projection*u_view*vec4(world_p, 0.0f, 1.0f);
   gl_Position = p;
   
   ivec2 atlas_size = textureSize(texture_image, 0);